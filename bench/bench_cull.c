@@ -0,0 +1,188 @@
+// This benchmark culls every map's chunks for views from the default
+// orthographic camera, at 8 angles around the map. Framed views see the
+// whole map, as it is shown when loaded. Zoomed views are as close as the
+// camera goes, looking at 9 points across the map. It reports the share
+// of triangles and chunks drawn, the draws they take and how long culling
+// takes.
+//
+// Usage: heretic-bench-cull <bin>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bin.h"
+#include "defines.h"
+#include "io.h"
+#include "maths.h"
+#include "mesh.h"
+
+// From camera.h, for a 16:9 window.
+#define FRAME_MARGIN 1.25f
+#define MIN_DISTANCE 2.5f
+#define MAX_DISTANCE 100.0f
+#define LATITUDE 30.0f
+#define ASPECT (9.0f / 16.0f)
+
+#define CULL_ROUNDS 100
+
+typedef struct {
+    f64 triangles;
+    f64 chunks;
+    f64 draws;
+    f64 ns;
+    u32 num_views;
+} cull_stats_t;
+
+typedef struct {
+    u32 num_indices;
+    u32 num_chunks;
+    u32 num_draws;
+} culled_t;
+
+static f64 now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1e9) + ts.tv_nsec;
+}
+
+// cull culls a geometry's chunks like draw_chunks in main.c.
+static culled_t cull(const mesh_t* mesh, const geometry_t* geometry, mat4 clip)
+{
+    frustum_t frustum = frustum_from_matrix(clip);
+    culled_t culled = { 0 };
+    u32 end = 0;
+    for (u32 i = 0; i < geometry->num_chunks; i++) {
+        const chunk_t* chunk = &mesh->chunks[geometry->first_chunk + i];
+        if (!frustum_has_aabb(&frustum, chunk->bounds)) {
+            continue;
+        }
+        if (culled.num_chunks == 0 || chunk->first_index != end) {
+            culled.num_draws++;
+        }
+        culled.num_indices += chunk->num_indices;
+        culled.num_chunks++;
+        end = chunk->first_index + chunk->num_indices;
+    }
+    return culled;
+}
+
+// cull_view adds what is drawn of a geometry from one view to `stats`.
+// Views are culled a few times over, as once is too quick to time.
+static void cull_view(const mesh_t* mesh, const geometry_t* geometry, vec3 target, f32 distance, f32 longitude, cull_stats_t* stats)
+{
+    f32 lat = radians(LATITUDE);
+    f32 lng = radians(longitude);
+    vec3 direction = { cosf(lat) * sinf(lng), sinf(lat), cosf(lat) * cosf(lng) };
+    mat4 view = mat4_look_at(vec3_add(target, vec3_mulf(direction, distance)), target, (vec3) { 0.0f, 1.0f, 0.0f });
+    mat4 proj = mat4_orthographic(-distance, distance, -distance * ASPECT, distance * ASPECT, 0.01f, 100.0f);
+    mat4 model = mat4_translation(mesh->center_transform);
+
+    culled_t culled = { 0 };
+    f64 start = now_ns();
+    for (i32 round = 0; round < CULL_ROUNDS; round++) {
+        culled = cull(mesh, geometry, mat4_mul(mat4_mul(model, view), proj));
+        __asm__ volatile("" : : "r"(&culled) : "memory");
+    }
+    stats->ns += (now_ns() - start) / CULL_ROUNDS;
+
+    stats->triangles += (f64)culled.num_indices / geometry->num_indices;
+    stats->chunks += (f64)culled.num_chunks / geometry->num_chunks;
+    stats->draws += culled.num_draws;
+    stats->num_views++;
+}
+
+static void print_stats(const cull_stats_t* stats)
+{
+    u32 n = stats->num_views > 0 ? stats->num_views : 1;
+    printf(" %7.1f%% %7.1f%% %6.1f %7.1f",
+        100.0 * stats->triangles / n, 100.0 * stats->chunks / n, stats->draws / n, stats->ns / n);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        printf("usage: %s <bin>\n", argv[0]);
+        return 1;
+    }
+
+    disc_t disc;
+    if (!disc_open(&disc, argv[1], DISC_BACKEND_DEFAULT)) {
+        printf("failed to open %s\n", argv[1]);
+        return 1;
+    }
+    mesh_t* mesh = calloc(1, sizeof(mesh_t));
+    if (mesh == NULL) {
+        printf("out of memory\n");
+        return 1;
+    }
+
+    printf("%4s %6s %6s %8s %8s %6s %7s %8s %8s %6s %7s\n", "", "", "",
+        "framed", "", "", "", "zoomed", "", "", "");
+    printf("%4s %6s %6s %8s %8s %6s %7s %8s %8s %6s %7s\n",
+        "map", "tris", "chunks", "tris", "chunks", "draws", "ns", "tris", "chunks", "draws", "ns");
+
+    cull_stats_t totals[2] = { 0 };
+    for (i32 map = 0; map < MAP_MAX_NUM; map++) {
+        if (find_map(&disc, map) == NULL) {
+            continue;
+        }
+        mesh_reset(mesh);
+        if (!read_map(&disc, map, NULL, mesh) || !mesh->is_mesh_valid) {
+            continue;
+        }
+
+        cull_stats_t framed = { 0 };
+        cull_stats_t zoomed = { 0 };
+        for (u32 v = 0; v < mesh->num_variants; v++) {
+            mesh_set_variant(mesh, v);
+            const geometry_t* geometry = &mesh->geometries[mesh_is_live(mesh, mesh->geometry) ? 0 : mesh->geometry];
+            if (geometry->num_chunks == 0) {
+                continue;
+            }
+            sphere_t sphere = mesh->bounding_sphere;
+            vec3 center = vec3_add(sphere.center, mesh->center_transform);
+            f32 distance = clamp(sphere.radius * FRAME_MARGIN, MIN_DISTANCE, MAX_DISTANCE);
+            for (u32 a = 0; a < 8; a++) {
+                f32 longitude = a * 45.0f;
+                cull_view(mesh, geometry, center, distance, longitude, &framed);
+                for (u32 p = 0; p < 9; p++) {
+                    aabb_t b = mesh->bounds;
+                    vec3 target = {
+                        b.min.x + ((b.max.x - b.min.x) * (f32)(p % 3) / 2.0f),
+                        center.y,
+                        b.min.z + ((b.max.z - b.min.z) * (f32)(p / 3) / 2.0f),
+                    };
+                    cull_view(mesh, geometry, vec3_add(target, mesh->center_transform), MIN_DISTANCE, longitude, &zoomed);
+                }
+            }
+        }
+
+        mesh_set_variant(mesh, 0);
+        const geometry_t* geometry = &mesh->geometries[mesh_is_live(mesh, mesh->geometry) ? 0 : mesh->geometry];
+        printf("%4d %6u %6u", map, geometry->num_indices / 3, geometry->num_chunks);
+        print_stats(&framed);
+        print_stats(&zoomed);
+        printf("\n");
+
+        cull_stats_t* stats[2] = { &framed, &zoomed };
+        for (u32 i = 0; i < 2; i++) {
+            totals[i].triangles += stats[i]->triangles;
+            totals[i].chunks += stats[i]->chunks;
+            totals[i].draws += stats[i]->draws;
+            totals[i].ns += stats[i]->ns;
+            totals[i].num_views += stats[i]->num_views;
+        }
+    }
+
+    printf("%4s %6s %6s", "avg", "", "");
+    print_stats(&totals[0]);
+    print_stats(&totals[1]);
+    printf("\n");
+
+    mesh_free(mesh);
+    free(mesh);
+    disc_close(&disc);
+    return 0;
+}
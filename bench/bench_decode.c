@@ -0,0 +1,134 @@
+// This benchmark decodes every map on the job system with an increasing
+// number of threads and reports the time and the speedup over one thread.
+// The image is read into memory first, so only decoding is measured.
+//
+// Usage: heretic-bench-decode <bin> [max threads] [rounds]
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bin.h"
+#include "defines.h"
+#include "io.h"
+#include "jobs.h"
+#include "mesh.h"
+
+typedef struct {
+    disc_t* disc;
+    jobs_t* jobs;
+    i32 map;
+    mesh_t* mesh;
+    bool success;
+} map_job_t;
+
+static f64 now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000.0) + (ts.tv_nsec / 1000000.0);
+}
+
+static void decode_map(void* data)
+{
+    map_job_t* job = data;
+    mesh_reset(job->mesh);
+    job->success = read_map(job->disc, job->map, job->jobs, job->mesh);
+}
+
+// bench_threads decodes every map once per round with `num_threads`
+// threads, the calling thread included, and returns the best round.
+static f64 bench_threads(map_job_t* maps, u32 num_maps, u32 num_threads, i32 rounds)
+{
+    static jobs_t jobs;
+    if (!jobs_init(&jobs, num_threads - 1)) {
+        return 0.0;
+    }
+
+    job_t batch[MAP_MAX_NUM];
+    for (u32 i = 0; i < num_maps; i++) {
+        maps[i].jobs = &jobs;
+        batch[i] = (job_t) { .fn = decode_map, .data = &maps[i] };
+    }
+
+    f64 best = 0.0;
+    for (i32 round = 0; round < rounds; round++) {
+        job_counter_t counter;
+        atomic_init(&counter.pending, 0);
+
+        f64 start = now_ms();
+        jobs_submit(&jobs, batch, num_maps, &counter);
+        jobs_wait(&jobs, &counter);
+        f64 ms = now_ms() - start;
+
+        if (round == 0 || ms < best) {
+            best = ms;
+        }
+    }
+
+    jobs_shutdown(&jobs);
+    return best;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        printf("usage: %s <bin> [max threads] [rounds]\n", argv[0]);
+        return 1;
+    }
+    const char* path = argv[1];
+    u32 max_threads = argc > 2 ? (u32)atoi(argv[2]) : jobs_default_workers() + 1;
+    i32 rounds = argc > 3 ? atoi(argv[3]) : 5;
+    if (max_threads < 1 || max_threads > JOBS_MAX_WORKERS + 1) {
+        printf("max threads must be between 1 and %d\n", JOBS_MAX_WORKERS + 1);
+        return 1;
+    }
+
+    disc_t disc;
+    if (!disc_open(&disc, path, &disc_backend_memory)) {
+        printf("failed to open %s\n", path);
+        return 1;
+    }
+
+    // Every map gets its own mesh so maps can be decoded at the same time.
+    static map_job_t maps[MAP_MAX_NUM];
+    u32 num_maps = 0;
+    for (i32 map = 0; map < MAP_MAX_NUM; map++) {
+        if (find_map(&disc, map) == NULL) {
+            continue;
+        }
+        mesh_t* mesh = calloc(1, sizeof(mesh_t));
+        if (mesh == NULL) {
+            printf("out of memory\n");
+            return 1;
+        }
+        maps[num_maps++] = (map_job_t) { .disc = &disc, .map = map, .mesh = mesh };
+    }
+
+    printf("%7s %5s %10s %10s %8s\n", "threads", "maps", "ms", "maps/s", "speedup");
+    f64 single = 0.0;
+    for (u32 num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+        f64 ms = bench_threads(maps, num_maps, num_threads, rounds);
+        if (num_threads == 1) {
+            single = ms;
+        }
+
+        u32 num_decoded = 0;
+        for (u32 i = 0; i < num_maps; i++) {
+            num_decoded += maps[i].success;
+        }
+        printf("%7u %5u %10.3f %10.1f %7.2fx\n",
+            num_threads, num_decoded, ms, num_decoded / (ms / 1000.0), single / ms);
+
+        // Make sure the largest count is measured too.
+        if (num_threads < max_threads && num_threads * 2 > max_threads) {
+            num_threads = max_threads / 2;
+        }
+    }
+
+    for (u32 i = 0; i < num_maps; i++) {
+        mesh_free(maps[i].mesh);
+        free(maps[i].mesh);
+    }
+    disc_close(&disc);
+    return 0;
+}
@@ -0,0 +1,196 @@
+// This benchmark loads every map's GNS file and its resources through each
+// disc backend and reports per-map latency percentiles and throughput, with a
+// warm page cache and with the page cache dropped before every map.
+//
+// Usage: heretic-bench-disc <bin> [rounds]
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bin.h"
+#include "defines.h"
+#include "io.h"
+#include "mesh.h"
+
+#define MAX_SAMPLES 4096
+
+typedef struct {
+    f64 samples[MAX_SAMPLES];
+    i32 num_samples;
+    u64 bytes;
+} stats_t;
+
+static f64 now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000.0) + (ts.tv_nsec / 1000000.0);
+}
+
+static bool count_bytes(u32 index, file_t* f, void* user)
+{
+    (void)index;
+    *(u64*)user += f->len;
+    return true;
+}
+
+// load_gns reads a GNS file and every resource it points to, the same
+// reads read_map does. It returns the number of bytes read, or 0 if the
+// map couldn't be read or isn't on the disc.
+static u64 load_gns(disc_t* disc, i32 map)
+{
+    const disc_file_t* gns_file = find_map(disc, map);
+    if (gns_file == NULL) {
+        return 0;
+    }
+
+    file_t gns = { 0 };
+    if (!read_file(disc, gns_file->sector, gns_file->len, &gns)) {
+        return 0;
+    }
+
+    record_t records[RECORD_MAX_NUM] = { 0 };
+    u16 num_records = 0;
+    bool records_ok = read_records(&gns, records, &num_records);
+    u64 bytes = gns.len;
+    file_free(&gns);
+    if (!records_ok) {
+        return 0;
+    }
+
+    file_request_t requests[RECORD_MAX_NUM];
+    for (i32 i = 0; i < num_records; i++) {
+        requests[i] = (file_request_t) { .sector = records[i].sector, .size = records[i].len };
+    }
+    if (!read_files(disc, requests, num_records, count_bytes, &bytes)) {
+        return 0;
+    }
+    return bytes;
+}
+
+// drop_page_cache asks the kernel to evict the image from the page cache.
+static void drop_page_cache(const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+static void record_sample(stats_t* stats, f64 ms, u64 bytes)
+{
+    // Maps that failed to load aren't counted.
+    if (bytes > 0 && stats->num_samples < MAX_SAMPLES) {
+        stats->samples[stats->num_samples++] = ms;
+        stats->bytes += bytes;
+    }
+}
+
+static i32 compare_f64(const void* a, const void* b)
+{
+    f64 x = *(const f64*)a;
+    f64 y = *(const f64*)b;
+    return (x > y) - (x < y);
+}
+
+static void print_stats(const char* backend, const char* mode, stats_t* stats)
+{
+    if (stats->num_samples == 0) {
+        printf("%-8s %-5s no samples\n", backend, mode);
+        return;
+    }
+
+    qsort(stats->samples, stats->num_samples, sizeof(f64), compare_f64);
+
+    f64 total = 0.0;
+    for (i32 i = 0; i < stats->num_samples; i++) {
+        total += stats->samples[i];
+    }
+
+    i32 n = stats->num_samples;
+    printf("%-8s %-5s %5d %9.3f %9.3f %9.3f %9.3f %10.1f\n",
+        backend, mode, n,
+        stats->samples[n / 2],
+        stats->samples[(n * 90) / 100],
+        stats->samples[(n * 99) / 100],
+        stats->samples[n - 1],
+        (stats->bytes / (1024.0 * 1024.0)) / (total / 1000.0));
+}
+
+static void bench_warm(const char* path, const disc_backend_t* backend, i32 rounds)
+{
+    disc_t disc;
+    if (!disc_open(&disc, path, backend)) {
+        printf("%-8s warm  unavailable\n", backend->name);
+        return;
+    }
+
+    // One untimed pass to fill the page cache.
+    for (i32 map = 0; map < MAP_MAX_NUM; map++) {
+        load_gns(&disc, map);
+    }
+
+    static stats_t stats;
+    stats = (stats_t) { 0 };
+    for (i32 round = 0; round < rounds; round++) {
+        for (i32 map = 0; map < MAP_MAX_NUM; map++) {
+            f64 start = now_ms();
+            u64 bytes = load_gns(&disc, map);
+            record_sample(&stats, now_ms() - start, bytes);
+        }
+    }
+    disc_close(&disc);
+
+    print_stats(backend->name, "warm", &stats);
+}
+
+// bench_cold reopens the disc for every map after dropping the page
+// cache, so mapped pages are released too. Only the load is timed.
+static void bench_cold(const char* path, const disc_backend_t* backend, i32 rounds)
+{
+    // The memory backend reads the whole image on open, so it's never cold.
+    if (backend == &disc_backend_memory) {
+        return;
+    }
+
+    static stats_t stats;
+    stats = (stats_t) { 0 };
+    for (i32 round = 0; round < rounds; round++) {
+        for (i32 map = 0; map < MAP_MAX_NUM; map++) {
+            drop_page_cache(path);
+            disc_t disc;
+            if (!disc_open(&disc, path, backend)) {
+                printf("%-8s cold  unavailable\n", backend->name);
+                return;
+            }
+            f64 start = now_ms();
+            u64 bytes = load_gns(&disc, map);
+            record_sample(&stats, now_ms() - start, bytes);
+            disc_close(&disc);
+        }
+    }
+
+    print_stats(backend->name, "cold", &stats);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        printf("usage: %s <bin> [rounds]\n", argv[0]);
+        return 1;
+    }
+    const char* path = argv[1];
+    i32 rounds = argc > 2 ? atoi(argv[2]) : 5;
+
+    printf("%-8s %-5s %5s %9s %9s %9s %9s %10s\n",
+        "backend", "cache", "maps", "p50 ms", "p90 ms", "p99 ms", "max ms", "MiB/s");
+    for (i32 i = 0; disc_backends[i] != NULL; i++) {
+        bench_warm(path, disc_backends[i], rounds);
+        bench_cold(path, disc_backends[i], rounds);
+    }
+    return 0;
+}
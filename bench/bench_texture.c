@@ -0,0 +1,346 @@
+// This benchmark unpacks every map's texture with each texture decoder,
+// into a palette index per byte and into RGBA8 through the map's first
+// palette. The baseline is the loop textures were expanded with before
+// they were uploaded packed, which wrote each index 4 times.
+//
+// It also converts every map's palettes against read_rgb15, and resolves
+// every page with every palette through a resolve cache, cold and warm.
+//
+// Before timing anything, every decoder is checked against the scalar
+// decoder over every byte, and against read_rgb15 over every RGB15
+// colour. The results must match byte for byte. It exits with 1 on a
+// mismatch.
+//
+// Usage: heretic-bench-texture <bin> [rounds]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bin.h"
+#include "decode.h"
+#include "defines.h"
+#include "io.h"
+#include "mesh.h"
+#include "resolve.h"
+
+typedef struct {
+    u8* textures;
+    u8* palettes;
+    u8* raw_palettes;
+    u32 count;
+} textures_t;
+
+// Bytes unpacked by the check, holding every value.
+#define NUM_CHECKED_BYTES 4096
+#define NUM_COLOURS 65536
+
+static u8 out[TEXTURE_NUM_PIXELS * 4];
+static u8 checked_src[NUM_CHECKED_BYTES];
+static u8 checked_colours[NUM_COLOURS * 2];
+static u8 want[NUM_COLOURS * 4];
+static u8 got[NUM_COLOURS * 4];
+
+static f64 now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1e9) + ts.tv_nsec;
+}
+
+static void expand_loop(const u8* src, u32 count, const u8* palette, u8* dst)
+{
+    (void)palette;
+    for (u32 i = 0, j = 0; i < count; i++, j += 8) {
+        u8 right = src[i] & 0x0F;
+        u8 left = (src[i] & 0xF0) >> 4;
+        dst[j + 0] = right;
+        dst[j + 1] = right;
+        dst[j + 2] = right;
+        dst[j + 3] = right;
+        dst[j + 4] = left;
+        dst[j + 5] = left;
+        dst[j + 6] = left;
+        dst[j + 7] = left;
+    }
+}
+
+static void (*indices_fn)(const u8*, u32, u8*);
+
+static void indices(const u8* src, u32 count, const u8* palette, u8* dst)
+{
+    (void)palette;
+    indices_fn(src, count, dst);
+}
+
+// bench returns the best time to unpack every texture once, in
+// microseconds per texture.
+static f64 bench(const textures_t* t, void (*unpack)(const u8*, u32, const u8*, u8*), i32 rounds)
+{
+    f64 best = 0.0;
+    for (i32 round = 0; round < rounds; round++) {
+        f64 start = now_ns();
+        for (u32 i = 0; i < t->count; i++) {
+            unpack(&t->textures[i * TEXTURE_NUM_BYTES], TEXTURE_NUM_BYTES, &t->palettes[i * PALETTE_NUM_BYTES], out);
+            // Keep the compiler from dropping repeated unpacks.
+            __asm__ volatile("" : : "r"(out) : "memory");
+        }
+        f64 us = (now_ns() - start) / (1000.0 * t->count);
+        if (round == 0 || us < best) {
+            best = us;
+        }
+    }
+    return best;
+}
+
+static void read_palettes(const u8* src, u32 count, u8* dst)
+{
+    file_t f = { .data = src, .len = count * 2 };
+    for (u32 i = 0; i < count; i++) {
+        vec4 c = read_rgb15(&f);
+        dst[i * 4 + 0] = c.x;
+        dst[i * 4 + 1] = c.y;
+        dst[i * 4 + 2] = c.z;
+        dst[i * 4 + 3] = c.w;
+    }
+}
+
+// check_run compares one decoder with the scalar one for `count` bytes
+// starting at `first`, and with read_rgb15 for the colours from `first`
+// on.
+static bool check_run(const texture_decoder_t* decoder, const u8* palette, u32 first, u32 count)
+{
+    const u8* data = &checked_src[first];
+    texture_decoder_scalar.indices(data, count, want);
+    decoder->indices(data, count, got);
+    if (memcmp(want, got, count * 2) != 0) {
+        printf("%s: indices differ from scalar\n", decoder->name);
+        return false;
+    }
+
+    texture_decoder_scalar.rgba(data, count, palette, want);
+    decoder->rgba(data, count, palette, got);
+    if (memcmp(want, got, count * 8) != 0) {
+        printf("%s: rgba differs from scalar\n", decoder->name);
+        return false;
+    }
+
+    u32 num_colours = NUM_COLOURS - first;
+    read_palettes(&checked_colours[first * 2], num_colours, want);
+    decoder->palette(&checked_colours[first * 2], num_colours, got);
+    if (memcmp(want, got, num_colours * 4) != 0) {
+        printf("%s: palette differs from read_rgb15\n", decoder->name);
+        return false;
+    }
+    return true;
+}
+
+// check compares every supported decoder with the references over every
+// byte and every RGB15 colour. Runs start at different offsets and end
+// short of the last, so each decoder's vector loop and scalar tail are
+// both covered.
+static bool check(void)
+{
+    for (u32 i = 0; i < NUM_CHECKED_BYTES; i++) {
+        checked_src[i] = (u8)(i * 167 + (i >> 8));
+    }
+    for (u32 i = 0; i < NUM_COLOURS; i++) {
+        u16 colour = (u16)i;
+        memcpy(&checked_colours[i * 2], &colour, sizeof(colour));
+    }
+
+    // A palette of distinct colours, so a wrong index shows up.
+    u8 palette[PALETTE_NUM_BYTES];
+    for (u32 i = 0; i < PALETTE_NUM_BYTES; i++) {
+        palette[i] = (u8)(i * 7 + 3);
+    }
+
+    bool success = true;
+    for (i32 i = 0; texture_decoders[i] != NULL; i++) {
+        const texture_decoder_t* decoder = texture_decoders[i];
+        if (!texture_decoder_supported(decoder)) {
+            continue;
+        }
+        for (u32 first = 0; success && first < 32; first++) {
+            success = check_run(decoder, palette, first, NUM_CHECKED_BYTES - (first * 2));
+        }
+    }
+    return success;
+}
+
+// bench_palettes returns the best time to convert every map's raw
+// palettes once, in nanoseconds per map.
+static f64 bench_palettes(const textures_t* t, void (*convert)(const u8*, u32, u8*), i32 rounds)
+{
+    f64 best = 0.0;
+    for (i32 round = 0; round < rounds; round++) {
+        f64 start = now_ns();
+        for (i32 n = 0; n < 100; n++) {
+            for (u32 i = 0; i < t->count; i++) {
+                convert(&t->raw_palettes[i * (PALETTE_NUM_BYTES / 2)], PALETTE_NUM_BYTES / 4, out);
+                __asm__ volatile("" : : "r"(out) : "memory");
+            }
+        }
+        f64 ns = (now_ns() - start) / (100.0 * t->count);
+        if (round == 0 || ns < best) {
+            best = ns;
+        }
+    }
+    return best;
+}
+
+// bench_resolve returns the time to resolve every page of every texture
+// with each of its palettes, in microseconds per texture.
+static f64 bench_resolve(const textures_t* t, resolve_cache_t* cache, mesh_t* meshes)
+{
+    f64 start = now_ns();
+    for (u32 i = 0; i < t->count; i++) {
+        for (u32 page = 0; page < TEXTURE_NUM_PAGES; page++) {
+            for (u32 palette = 0; palette < 16; palette++) {
+                const u8* pixels = resolve_page(cache, &meshes[i], page, palette);
+                __asm__ volatile("" : : "r"(pixels) : "memory");
+            }
+        }
+    }
+    return (now_ns() - start) / (1000.0 * t->count);
+}
+
+static void print_row(const char* name, const char* kind, f64 us, f64 baseline)
+{
+    printf("%-8s %-8s %10.2f %9.2f %7.2fx\n", name, kind, us, TEXTURE_NUM_BYTES / us, baseline / us);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        printf("usage: %s <bin> [rounds]\n", argv[0]);
+        return 1;
+    }
+    i32 rounds = argc > 2 ? atoi(argv[2]) : 20;
+
+    if (!check()) {
+        return 1;
+    }
+
+    disc_t disc;
+    if (!disc_open(&disc, argv[1], DISC_BACKEND_DEFAULT)) {
+        printf("failed to open %s\n", argv[1]);
+        return 1;
+    }
+
+    textures_t t = {
+        .textures = malloc((u64)MAP_MAX_NUM * TEXTURE_NUM_BYTES),
+        .palettes = malloc((u64)MAP_MAX_NUM * PALETTE_NUM_BYTES),
+        .raw_palettes = malloc((u64)MAP_MAX_NUM * (PALETTE_NUM_BYTES / 2)),
+    };
+    mesh_t* mesh = calloc(1, sizeof(mesh_t));
+    if (t.textures == NULL || t.palettes == NULL || t.raw_palettes == NULL || mesh == NULL) {
+        printf("out of memory\n");
+        return 1;
+    }
+
+    for (i32 map = 0; map < MAP_MAX_NUM; map++) {
+        if (find_map(&disc, map) == NULL) {
+            continue;
+        }
+        mesh_reset(mesh);
+        if (!read_map(&disc, map, NULL, mesh) || !mesh->is_texture_valid) {
+            continue;
+        }
+        memcpy(&t.textures[t.count * TEXTURE_NUM_BYTES], mesh->texture, TEXTURE_NUM_BYTES);
+        memcpy(&t.palettes[t.count * PALETTE_NUM_BYTES], mesh->palette, PALETTE_NUM_BYTES);
+
+        // Raw palettes aren't kept, so they are packed back into RGB15.
+        for (u32 i = 0; i < PALETTE_NUM_BYTES / 4; i++) {
+            const u8* c = &mesh->palette[i * 4];
+            u16 raw = (c[0] >> 3) | ((c[1] >> 3) << 5) | ((c[2] >> 3) << 10) | (c[3] != 0 && c[0] == 0 && c[1] == 0 && c[2] == 0 ? 0x8000 : 0);
+            memcpy(&t.raw_palettes[(t.count * (PALETTE_NUM_BYTES / 4) + i) * 2], &raw, sizeof(raw));
+        }
+        t.count++;
+    }
+    if (t.count == 0) {
+        printf("no textures found\n");
+        return 1;
+    }
+
+    printf("%u textures of %d KiB\n", t.count, TEXTURE_NUM_BYTES / 1024);
+    printf("%-8s %-8s %10s %9s %8s\n", "decoder", "output", "us/tex", "MB/s", "speedup");
+
+    f64 baseline = bench(&t, expand_loop, rounds);
+    print_row("loop", "expanded", baseline, baseline);
+
+    for (i32 i = 0; texture_decoders[i] != NULL; i++) {
+        const texture_decoder_t* decoder = texture_decoders[i];
+        if (!texture_decoder_supported(decoder)) {
+            printf("%-8s unsupported\n", decoder->name);
+            continue;
+        }
+        indices_fn = decoder->indices;
+        print_row(decoder->name, "indices", bench(&t, indices, rounds), baseline);
+        print_row(decoder->name, "rgba", bench(&t, decoder->rgba, rounds), baseline);
+    }
+
+    printf("\n%-8s %10s %8s\n", "palette", "ns/map", "speedup");
+    f64 palettes = bench_palettes(&t, read_palettes, rounds);
+    printf("%-8s %10.1f %7.2fx\n", "rgb15", palettes, 1.0);
+    for (i32 i = 0; texture_decoders[i] != NULL; i++) {
+        const texture_decoder_t* decoder = texture_decoders[i];
+        if (texture_decoder_supported(decoder)) {
+            f64 ns = bench_palettes(&t, decoder->palette, rounds);
+            printf("%-8s %10.1f %7.2fx\n", decoder->name, ns, palettes / ns);
+        }
+    }
+
+    // Each texture gets its own mesh, as pages are cached by texture.
+    mesh_t* meshes = calloc(t.count, sizeof(mesh_t));
+    if (meshes == NULL) {
+        printf("out of memory\n");
+        return 1;
+    }
+    for (u32 i = 0; i < t.count; i++) {
+        if (!mesh_alloc_textures(&meshes[i], 1)) {
+            printf("out of memory\n");
+            return 1;
+        }
+        memcpy(meshes[i].textures, &t.textures[i * TEXTURE_NUM_BYTES], TEXTURE_NUM_BYTES);
+        memcpy(meshes[i].variants[0].palette, &t.palettes[i * PALETTE_NUM_BYTES], PALETTE_NUM_BYTES);
+        meshes[i].num_variants = 1;
+        mesh_set_variant(&meshes[i], 0);
+    }
+
+    // A cache as big as one texture's pages with 4 palettes, resolving one
+    // page with 4 palettes at a time, is a palette switcher's workload.
+    resolve_cache_t cache = { 0 };
+    printf("\n%-8s %10s\n", "resolve", "us/tex");
+    printf("%-8s %10.2f\n", "all", bench_resolve(&t, &cache, meshes));
+    f64 cold = 0.0;
+    f64 warm = 0.0;
+    for (u32 i = 0; i < t.count; i++) {
+        for (u32 round = 0; round < 2; round++) {
+            f64 start = now_ns();
+            for (u32 page = 0; page < TEXTURE_NUM_PAGES; page++) {
+                for (u32 palette = 0; palette < 4; palette++) {
+                    const u8* pixels = resolve_page(&cache, &meshes[i], page, palette);
+                    __asm__ volatile("" : : "r"(pixels) : "memory");
+                }
+            }
+            *(round == 0 ? &cold : &warm) += (now_ns() - start) / 1000.0;
+        }
+    }
+    printf("%-8s %10.2f\n", "cold", cold / t.count);
+    printf("%-8s %10.2f\n", "warm", warm / t.count);
+
+    resolve_cache_free(&cache);
+    for (u32 i = 0; i < t.count; i++) {
+        mesh_free(&meshes[i]);
+    }
+    free(meshes);
+
+    mesh_free(mesh);
+    free(mesh);
+    free(t.textures);
+    free(t.palettes);
+    free(t.raw_palettes);
+    disc_close(&disc);
+    return 0;
+}
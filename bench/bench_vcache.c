@@ -0,0 +1,82 @@
+// This benchmark reports the average cache miss ratio (ACMR) of every
+// map's index buffer as decoded and after vcache_optimize, for FIFO
+// caches of 16 and 32 vertices, and how long the optimisation takes.
+//
+// Usage: heretic-bench-vcache <bin>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bin.h"
+#include "defines.h"
+#include "io.h"
+#include "mesh.h"
+#include "vcache.h"
+
+static f64 now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000.0) + (ts.tv_nsec / 1000000.0);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        printf("usage: %s <bin>\n", argv[0]);
+        return 1;
+    }
+
+    disc_t disc;
+    if (!disc_open(&disc, argv[1], DISC_BACKEND_DEFAULT)) {
+        printf("failed to open %s\n", argv[1]);
+        return 1;
+    }
+    mesh_t* mesh = calloc(1, sizeof(mesh_t));
+    if (mesh == NULL) {
+        printf("out of memory\n");
+        return 1;
+    }
+
+    printf("%4s %6s %6s %8s %8s %8s %8s %8s\n",
+        "map", "verts", "tris", "fifo16", "opt16", "fifo32", "opt32", "ms");
+
+    f64 totals[5] = { 0 };
+    i32 num_maps = 0;
+    for (i32 map = 0; map < MAP_MAX_NUM; map++) {
+        if (find_map(&disc, map) == NULL) {
+            continue;
+        }
+        mesh_reset(mesh);
+        if (!read_map(&disc, map, NULL, mesh)) {
+            continue;
+        }
+
+        f32 before16 = vcache_acmr(mesh->indices, mesh->num_indices, 16);
+        f32 before32 = vcache_acmr(mesh->indices, mesh->num_indices, 32);
+        f64 start = now_ms();
+        vcache_optimize(mesh);
+        f64 ms = now_ms() - start;
+        f32 after16 = vcache_acmr(mesh->indices, mesh->num_indices, 16);
+        f32 after32 = vcache_acmr(mesh->indices, mesh->num_indices, 32);
+
+        printf("%4d %6u %6u %8.3f %8.3f %8.3f %8.3f %8.3f\n",
+            map, mesh->num_vertices, mesh->num_indices / 3, before16, after16, before32, after32, ms);
+        totals[0] += before16;
+        totals[1] += after16;
+        totals[2] += before32;
+        totals[3] += after32;
+        totals[4] += ms;
+        num_maps++;
+    }
+
+    if (num_maps > 0) {
+        printf("%4s %6s %6s %8.3f %8.3f %8.3f %8.3f %8.3f\n", "avg", "", "",
+            totals[0] / num_maps, totals[1] / num_maps, totals[2] / num_maps, totals[3] / num_maps, totals[4] / num_maps);
+    }
+
+    mesh_free(mesh);
+    free(mesh);
+    disc_close(&disc);
+    return 0;
+}
@@ -0,0 +1,198 @@
+// This benchmark compares decoding packed positions and normals one value
+// at a time with read_position and read_normal against each bulk decoder.
+// The run is about the size of the largest map mesh.
+//
+// Positions are also decoded with their bounds, once with a second pass
+// over the decoded positions and once with each decoder's bounded decode.
+//
+// Before timing anything, every decoder is checked against read_position,
+// read_normal and the scalar bounds over every i16 value. The results
+// must match bit for bit, as cached maps assume they do. It exits with 1
+// on a mismatch.
+//
+// Usage: heretic-bench-vertex [rounds]
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bin.h"
+#include "decode.h"
+#include "defines.h"
+#include "mesh.h"
+
+#define NUM_TRIPLETS 4096
+
+// Every i16 value appears once in each component of the checked triplets.
+#define NUM_CHECKED 65536
+
+static u8 src[NUM_TRIPLETS * 6];
+static vec3 out[NUM_TRIPLETS];
+static aabb_t bounds;
+static const vertex_decoder_t* decoder;
+
+static u8 checked_src[NUM_CHECKED * 6];
+static vec3 want[NUM_CHECKED];
+static vec3 got[NUM_CHECKED];
+
+static f64 now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1e9) + ts.tv_nsec;
+}
+
+static void read_positions(const u8* data, u32 count, vec3* dst)
+{
+    file_t f = { .data = data, .len = count * 6 };
+    for (u32 i = 0; i < count; i++) {
+        dst[i] = read_position(&f);
+    }
+}
+
+static void read_normals(const u8* data, u32 count, vec3* dst)
+{
+    file_t f = { .data = data, .len = count * 6 };
+    for (u32 i = 0; i < count; i++) {
+        dst[i] = read_normal(&f);
+    }
+}
+
+// positions_then_bounds finds the bounds the way maps were centered before
+// they were found while decoding.
+static void positions_then_bounds(const u8* data, u32 count, vec3* dst)
+{
+    decoder->positions(data, count, dst);
+    bounds = aabb_empty();
+    for (u32 i = 0; i < count; i++) {
+        vec3 p = dst[i];
+        bounds.min.x = fmin(p.x, bounds.min.x);
+        bounds.min.y = fmin(p.y, bounds.min.y);
+        bounds.min.z = fmin(p.z, bounds.min.z);
+        bounds.max.x = fmax(p.x, bounds.max.x);
+        bounds.max.y = fmax(p.y, bounds.max.y);
+        bounds.max.z = fmax(p.z, bounds.max.z);
+    }
+}
+
+static void bounded_positions(const u8* data, u32 count, vec3* dst)
+{
+    bounds = aabb_empty();
+    decoder->bounded_positions(data, count, dst, &bounds);
+}
+
+// check_run compares one decoder's positions, normals and bounds for
+// `count` triplets starting at `first` with the reference decodes.
+static bool check_run(const vertex_decoder_t* decoder, u32 first, u32 count)
+{
+    const u8* data = &checked_src[first * 6];
+    u64 len = count * sizeof(vec3);
+
+    read_positions(data, count, want);
+    decoder->positions(data, count, got);
+    if (memcmp(want, got, len) != 0) {
+        printf("%s: positions differ from read_position\n", decoder->name);
+        return false;
+    }
+
+    aabb_t want_bounds = aabb_empty();
+    aabb_t got_bounds = aabb_empty();
+    vertex_decoder_scalar.bounded_positions(data, count, want, &want_bounds);
+    decoder->bounded_positions(data, count, got, &got_bounds);
+    if (memcmp(want, got, len) != 0 || memcmp(&want_bounds, &got_bounds, sizeof(aabb_t)) != 0) {
+        printf("%s: bounded positions differ from scalar\n", decoder->name);
+        return false;
+    }
+
+    read_normals(data, count, want);
+    decoder->normals(data, count, got);
+    if (memcmp(want, got, len) != 0) {
+        printf("%s: normals differ from read_normal\n", decoder->name);
+        return false;
+    }
+    return true;
+}
+
+// check compares every supported decoder with the references over every
+// i16 value. Runs start at different triplets and end short of the last,
+// so each decoder's vector loop and scalar tail are both covered.
+static bool check(void)
+{
+    for (u32 i = 0; i < NUM_CHECKED; i++) {
+        // Odd multipliers visit every value once, in a different order per
+        // component.
+        u16 v[3] = { (u16)i, (u16)(i * 3 + 1), (u16)(i * 7 + 2) };
+        memcpy(&checked_src[i * 6], v, sizeof(v));
+    }
+
+    bool success = true;
+    for (i32 i = 0; vertex_decoders[i] != NULL; i++) {
+        const vertex_decoder_t* decoder = vertex_decoders[i];
+        if (!vertex_decoder_supported(decoder)) {
+            continue;
+        }
+        for (u32 first = 0; success && first < 16; first++) {
+            success = check_run(decoder, first, NUM_CHECKED - (first * 2));
+        }
+    }
+    return success;
+}
+
+// bench returns the best time per triplet in nanoseconds.
+static f64 bench(void (*decode)(const u8*, u32, vec3*), i32 rounds)
+{
+    f64 best = 0.0;
+    for (i32 round = 0; round < rounds; round++) {
+        f64 start = now_ns();
+        for (i32 i = 0; i < 100; i++) {
+            decode(src, NUM_TRIPLETS, out);
+            // Keep the compiler from dropping repeated decodes.
+            __asm__ volatile("" : : "r"(out) : "memory");
+        }
+        f64 ns = (now_ns() - start) / (100.0 * NUM_TRIPLETS);
+        if (round == 0 || ns < best) {
+            best = ns;
+        }
+    }
+    return best;
+}
+
+static void print_row(const char* name, const char* kind, f64 ns, f64 baseline)
+{
+    printf("%-14s %-9s %9.3f %7.2fx\n", name, kind, ns, baseline / ns);
+}
+
+int main(int argc, char* argv[])
+{
+    i32 rounds = argc > 1 ? atoi(argv[1]) : 20;
+
+    if (!check()) {
+        return 1;
+    }
+
+    srand(1);
+    for (u32 i = 0; i < sizeof(src); i++) {
+        src[i] = (u8)rand();
+    }
+
+    printf("%-14s %-9s %9s %8s\n", "decoder", "data", "ns/vert", "speedup");
+
+    f64 positions = bench(read_positions, rounds);
+    f64 normals = bench(read_normals, rounds);
+    print_row("read_position", "positions", positions, positions);
+    print_row("read_normal", "normals", normals, normals);
+
+    for (i32 i = 0; vertex_decoders[i] != NULL; i++) {
+        decoder = vertex_decoders[i];
+        if (!vertex_decoder_supported(decoder)) {
+            printf("%-14s unsupported\n", decoder->name);
+            continue;
+        }
+        print_row(decoder->name, "positions", bench(decoder->positions, rounds), positions);
+        print_row(decoder->name, "normals", bench(decoder->normals, rounds), normals);
+        print_row(decoder->name, "+bounds", bench(positions_then_bounds, rounds), positions);
+        print_row(decoder->name, "bounded", bench(bounded_positions, rounds), positions);
+    }
+    return 0;
+}
@@ -0,0 +1,52 @@
+#include <stdlib.h>
+
+#include "arena.h"
+
+// arena_aligned rounds a size up to the alignment of every allocation.
+u64 arena_aligned(u64 size)
+{
+    return (size + ARENA_ALIGN - 1) & ~(u64)(ARENA_ALIGN - 1);
+}
+
+// arena_reserve empties the arena and makes sure it can hold `size` bytes.
+// The block is only reallocated when it is too small.
+bool arena_reserve(arena_t* arena, u64 size)
+{
+    arena->used = 0;
+    if (size <= arena->size) {
+        return true;
+    }
+
+    // An arena always has a block, so even empty allocations succeed.
+    arena_free(arena);
+    arena->data = malloc(size > 0 ? size : ARENA_ALIGN);
+    if (arena->data == NULL) {
+        return false;
+    }
+    arena->size = size;
+    return true;
+}
+
+// arena_alloc returns `size` bytes from the arena, or NULL if it is full.
+// The memory isn't zeroed.
+void* arena_alloc(arena_t* arena, u64 size)
+{
+    u64 aligned = arena_aligned(size);
+    if (arena->data == NULL || aligned > arena->size - arena->used) {
+        return NULL;
+    }
+    void* ptr = &arena->data[arena->used];
+    arena->used += aligned;
+    return ptr;
+}
+
+void arena_reset(arena_t* arena)
+{
+    arena->used = 0;
+}
+
+void arena_free(arena_t* arena)
+{
+    free(arena->data);
+    *arena = (arena_t) { 0 };
+}
@@ -0,0 +1,22 @@
+// This file contains a simple arena allocator.
+//
+// An arena is one block of memory that allocations are carved out of in
+// order. Everything in it is freed at once, and the block is kept to be
+// reused when the arena is reset.
+#pragma once
+
+#include "defines.h"
+
+#define ARENA_ALIGN 16
+
+typedef struct {
+    u8* data;
+    u64 size;
+    u64 used;
+} arena_t;
+
+bool arena_reserve(arena_t* arena, u64 size);
+void* arena_alloc(arena_t* arena, u64 size);
+void arena_reset(arena_t* arena);
+void arena_free(arena_t* arena);
+u64 arena_aligned(u64 size);
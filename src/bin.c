@@ -1,80 +1,511 @@
+#include <fcntl.h>
 #include <math.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "bin.h"
+#include "iso.h"
 
-// read_sector reads a sector to `out_bytes`.
-static bool read_sector(FILE* f, i32 sector, u8* out_bytes)
+// The sync pattern at the start of every raw sector.
+static const u8 sector_sync[12] = { 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00 };
+
+// forward declarations
+static bool detect_layout(disc_t* disc);
+static bool read_cso_header(disc_t* disc);
+static u64 block_offset(disc_t* disc, i32 block);
+
+// disc_open opens a BIN file and reads it with `backend`.
+bool disc_open(disc_t* disc, const char* filename, const disc_backend_t* backend)
+{
+    *disc = (disc_t) { .fd = -1 };
+
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    *disc = (disc_t) {
+        .path = strdup(filename),
+        .backend = backend,
+        .fd = fd,
+        .size = st.st_size,
+    };
+
+    if (!backend->open(disc)) {
+        free(disc->path);
+        close(fd);
+        *disc = (disc_t) { .fd = -1 };
+        return false;
+    }
+
+    if (!detect_layout(disc) || !iso_index(disc)) {
+        disc_close(disc);
+        return false;
+    }
+    return true;
+}
+
+// disc_close closes the backend and the BIN file.
+void disc_close(disc_t* disc)
+{
+    if (disc->backend != NULL) {
+        disc->backend->close(disc);
+    }
+    free(disc->path);
+    free(disc->block_index);
+    free(disc->files);
+    if (disc->fd != -1) {
+        close(disc->fd);
+    }
+    *disc = (disc_t) { .fd = -1 };
+}
+
+// detect_layout works out how sectors are stored in the image. Raw images
+// start with a sector sync pattern, and the mode byte of the first sector
+// says how big the sector header is. Cooked images have the ISO9660
+// volume descriptor at sector 16. Compressed images start with "CISO".
+static bool detect_layout(disc_t* disc)
+{
+    u8 header[SECTOR_HEADER_SIZE] = { 0 };
+    if (!disc->backend->read(disc, 0, sizeof(header), header)) {
+        return false;
+    }
+
+    if (memcmp(header, "CISO", 4) == 0) {
+        disc->layout = DiscLayoutCompressed;
+        return read_cso_header(disc);
+    }
+
+    if (memcmp(header, sector_sync, sizeof(sector_sync)) == 0) {
+        disc->layout = DiscLayoutRaw;
+        disc->sector_size = SECTOR_SIZE_RAW;
+        disc->sector_header_size = header[15] == 1 ? SECTOR_HEADER_SIZE_MODE1 : SECTOR_HEADER_SIZE;
+        disc->num_sectors = disc->size / SECTOR_SIZE_RAW;
+        return true;
+    }
+
+    u8 volume_id[5] = { 0 };
+    u64 volume_offset = (16 * SECTOR_SIZE) + 1;
+    if (disc->size >= volume_offset + sizeof(volume_id)
+        && disc->backend->read(disc, volume_offset, sizeof(volume_id), volume_id)
+        && memcmp(volume_id, "CD001", sizeof(volume_id)) == 0) {
+        disc->layout = DiscLayoutIso;
+        disc->sector_size = SECTOR_SIZE;
+        disc->sector_header_size = 0;
+        disc->num_sectors = disc->size / SECTOR_SIZE;
+        return true;
+    }
+
+    return false;
+}
+
+// read_cso_header reads the header and block index of a CISO image. The
+// image is split into blocks of one sector, each deflated on its own, so
+// any sector can be found with the index and inflated by itself.
+//
+// Header: "CISO", u32 header size, u64 uncompressed size, u32 block size,
+// u8 version, u8 index alignment, u16 reserved. Then one u32 per block,
+// plus one to mark the end of the last block. The low 31 bits are the
+// block's offset shifted right by the alignment, the top bit is set if
+// the block is stored uncompressed.
+//
+// Nothing in the header is trusted. The index has to fit in the image,
+// and its blocks have to run in order from the end of the index to no
+// further than the end of the image, so every block can be read as is.
+static bool read_cso_header(disc_t* disc)
+{
+    u8 header[24];
+    if (!disc->backend->read(disc, 0, sizeof(header), header)) {
+        return false;
+    }
+
+    u32 header_size;
+    u64 total_bytes;
+    u32 block_size;
+    memcpy(&header_size, &header[4], sizeof(u32));
+    memcpy(&total_bytes, &header[8], sizeof(u64));
+    memcpy(&block_size, &header[16], sizeof(u32));
+    disc->block_align = header[21];
+
+    // Some writers leave the header size at 0.
+    if ((header_size != 0 && header_size != sizeof(header)) || disc->block_align > 31) {
+        return false;
+    }
+
+    if (block_size == SECTOR_SIZE_RAW) {
+        disc->sector_size = SECTOR_SIZE_RAW;
+        disc->sector_header_size = SECTOR_HEADER_SIZE;
+    } else if (block_size == SECTOR_SIZE) {
+        disc->sector_size = SECTOR_SIZE;
+        disc->sector_header_size = 0;
+    } else {
+        return false;
+    }
+    // Sectors are numbered with i32s.
+    if (total_bytes / block_size >= INT32_MAX) {
+        return false;
+    }
+    disc->num_sectors = total_bytes / block_size;
+
+    u64 index_len = ((u64)disc->num_sectors + 1) * sizeof(u32);
+    if (sizeof(header) + index_len > disc->size) {
+        return false;
+    }
+    disc->block_index = malloc(index_len);
+    if (disc->block_index == NULL
+        || !disc->backend->read(disc, sizeof(header), index_len, (u8*)disc->block_index)) {
+        return false;
+    }
+
+    u64 prev_offset = sizeof(header) + index_len;
+    for (i32 i = 0; i <= (i32)disc->num_sectors; i++) {
+        u64 offset = block_offset(disc, i);
+        if (offset < prev_offset) {
+            return false;
+        }
+        prev_offset = offset;
+    }
+    return prev_offset <= disc->size;
+}
+
+// block_offset returns where a block starts in a compressed image.
+static u64 block_offset(disc_t* disc, i32 block)
+{
+    return (u64)(disc->block_index[block] & 0x7FFFFFFF) << disc->block_align;
+}
+
+// inflate_sectors decompresses `count` blocks starting at `sector` into
+// their payloads. `compressed` holds the blocks, starting at the first.
+static bool inflate_sectors(disc_t* disc, i32 sector, i32 count, const u8* compressed, u8* out_bytes)
 {
-    i32 seek_to = (sector * SECTOR_SIZE_RAW) + SECTOR_HEADER_SIZE;
-    if (fseek(f, seek_to, SEEK_SET) != 0) {
+    z_stream stream = { 0 };
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
         return false;
     }
-    size_t n = fread(out_bytes, sizeof(u8), SECTOR_SIZE, f);
-    bool success = n == SECTOR_SIZE;
+
+    bool success = true;
+    u64 base = block_offset(disc, sector);
+    u8 block[SECTOR_SIZE_RAW];
+    for (i32 i = 0; success && i < count; i++) {
+        u64 start = block_offset(disc, sector + i);
+        u64 end = block_offset(disc, sector + i + 1);
+        if (start < base || end < start) {
+            success = false;
+            break;
+        }
+        const u8* src = compressed + (start - base);
+
+        // A block that is short or doesn't inflate to a whole sector is
+        // never copied, so a corrupt image can't read past `compressed`.
+        const u8* payload = src;
+        bool is_plain = disc->block_index[sector + i] & 0x80000000;
+        if (is_plain) {
+            success = end - start >= disc->sector_size;
+        } else {
+            inflateReset(&stream);
+            stream.next_in = (u8*)src;
+            stream.avail_in = end - start;
+            stream.next_out = block;
+            stream.avail_out = disc->sector_size;
+            inflate(&stream, Z_FINISH);
+            success = stream.avail_out == 0;
+            payload = block;
+        }
+        if (!success) {
+            break;
+        }
+
+        memcpy(out_bytes + (i * SECTOR_SIZE), payload + disc->sector_header_size, SECTOR_SIZE);
+    }
+
+    inflateEnd(&stream);
     return success;
 }
 
-// read_file reads an entire file, sector by sector.
-bool read_file(FILE* f, i32 sector, i32 size, file_t* out_file)
+// gather_sectors copies the 2048-byte payload of each sector in `raw` to
+// `out_bytes`. They may overlap as long as `out_bytes` <= `raw`, since
+// every payload moves towards the start of the buffer.
+static void gather_sectors(disc_t* disc, const u8* raw, i32 count, u8* out_bytes)
+{
+    raw += disc->sector_header_size;
+    for (i32 i = 0; i < count; i++) {
+        memmove(out_bytes, raw, SECTOR_SIZE);
+        raw += disc->sector_size;
+        out_bytes += SECTOR_SIZE;
+    }
+}
+
+// file_begin validates a file and sets up its view. When the image is in
+// memory a file whose payload is contiguous in the image, either because
+// it fits in one sector or the image is cooked, points straight into it.
+// Other files are gathered or inflated into a buffer. When the image isn't
+// in memory `out_read` is filled with the whole run of sectors to read,
+// and file_end must be called once it has been read.
+static bool file_begin(disc_t* disc, i32 sector, i32 size, file_t* out_file, disc_read_t* out_read)
 {
+    *out_file = (file_t) { 0 };
+    *out_read = (disc_read_t) { 0 };
+
     i32 occupied_sectors = ceil((f32)size / (f32)SECTOR_SIZE);
-    for (i32 i = 0; i < occupied_sectors; i++) {
-        u8 sector_data[SECTOR_SIZE];
-        read_sector(f, sector + i, sector_data);
-        memcpy(out_file->data + out_file->len, sector_data, SECTOR_SIZE);
-        out_file->len += SECTOR_SIZE;
+    if (size <= 0 || occupied_sectors * SECTOR_SIZE > FILE_MAX_SIZE) {
+        return false;
+    }
+    if (sector < 0 || (u64)sector + occupied_sectors > disc->num_sectors) {
+        return false;
+    }
+
+    out_file->len = occupied_sectors * SECTOR_SIZE;
+
+    // Compressed images are read as the run of blocks, which is inflated
+    // into the start of the same buffer.
+    if (disc->layout == DiscLayoutCompressed) {
+        u64 start = block_offset(disc, sector);
+        u64 end = block_offset(disc, sector + occupied_sectors);
+        if (end < start || end > disc->size) {
+            return false;
+        }
+        out_file->buffer = malloc(out_file->len + (end - start));
+        if (out_file->buffer == NULL) {
+            return false;
+        }
+        out_file->data = out_file->buffer;
+
+        if (disc->data != NULL) {
+            return inflate_sectors(disc, sector, occupied_sectors, disc->data + start, out_file->buffer);
+        }
+        *out_read = (disc_read_t) {
+            .offset = start,
+            .len = end - start,
+            .out_bytes = out_file->buffer + out_file->len,
+        };
+        return true;
+    }
+
+    u64 offset = (u64)sector * disc->sector_size;
+    if (disc->data != NULL) {
+        const u8* raw = disc->data + offset;
+        if (occupied_sectors == 1 || disc->sector_size == SECTOR_SIZE) {
+            out_file->data = raw + disc->sector_header_size;
+            return true;
+        }
+
+        out_file->buffer = malloc(out_file->len);
+        if (out_file->buffer == NULL) {
+            return false;
+        }
+        gather_sectors(disc, raw, occupied_sectors, out_file->buffer);
+        out_file->data = out_file->buffer;
+        return true;
+    }
+
+    u64 raw_len = (u64)occupied_sectors * disc->sector_size;
+    out_file->buffer = malloc(raw_len);
+    if (out_file->buffer == NULL) {
+        return false;
+    }
+    out_file->data = out_file->buffer;
+    *out_read = (disc_read_t) {
+        .offset = offset,
+        .len = raw_len,
+        .out_bytes = out_file->buffer,
+    };
+    return true;
+}
+
+// file_end turns the sectors read for a file into its payload.
+static bool file_end(disc_t* disc, i32 sector, file_t* f)
+{
+    i32 occupied_sectors = f->len / SECTOR_SIZE;
+    if (disc->layout == DiscLayoutCompressed) {
+        return inflate_sectors(disc, sector, occupied_sectors, f->buffer + f->len, f->buffer);
+    }
+    if (disc->sector_size != SECTOR_SIZE) {
+        gather_sectors(disc, f->buffer, occupied_sectors, f->buffer);
     }
-    out_file->offset = 0;
     return true;
 }
 
+// read_file returns a view of an entire file. Without the image in memory
+// the whole run of sectors is read at once and its payloads are compacted
+// in place.
+bool read_file(disc_t* disc, i32 sector, i32 size, file_t* out_file)
+{
+    disc_read_t read;
+    if (!file_begin(disc, sector, size, out_file, &read)) {
+        file_free(out_file);
+        return false;
+    }
+    if (read.len == 0) {
+        return true;
+    }
+    if (!disc->backend->read(disc, read.offset, read.len, read.out_bytes)
+        || !file_end(disc, sector, out_file)) {
+        file_free(out_file);
+        return false;
+    }
+    return true;
+}
+
+typedef struct {
+    disc_t* disc;
+    const file_request_t* requests;
+    file_t* files;
+    file_done_fn done;
+    void* user;
+} read_files_t;
+
+static bool read_files_done(disc_read_t* read, void* user)
+{
+    read_files_t* batch = user;
+    file_t* f = &batch->files[read->index];
+    if (!file_end(batch->disc, batch->requests[read->index].sector, f)) {
+        return false;
+    }
+    bool success = batch->done(read->index, f, batch->user);
+    file_free(f);
+    return success;
+}
+
+// read_files reads many files at once and calls `done` with each file as
+// soon as it has been read, in no particular order. Backends that support
+// it have every read in flight at the same time. The file passed to
+// `done` is only valid until it returns. Reading stops at the first
+// failed read or the first time `done` returns false.
+bool read_files(disc_t* disc, const file_request_t* requests, u32 count, file_done_fn done, void* user)
+{
+    file_t* files = calloc(count, sizeof(file_t));
+    disc_read_t* reads = calloc(count, sizeof(disc_read_t));
+    if (files == NULL || reads == NULL) {
+        free(files);
+        free(reads);
+        return false;
+    }
+
+    // Files that are already in memory are handed over straight away,
+    // the rest are read as one batch.
+    bool success = true;
+    u32 num_reads = 0;
+    for (u32 i = 0; success && i < count; i++) {
+        disc_read_t read;
+        success = file_begin(disc, requests[i].sector, requests[i].size, &files[i], &read);
+        if (!success) {
+            break;
+        }
+        if (read.len == 0) {
+            success = done(i, &files[i], user);
+            file_free(&files[i]);
+            continue;
+        }
+        read.index = i;
+        reads[num_reads++] = read;
+    }
+
+    if (success && num_reads > 0) {
+        read_files_t batch = {
+            .disc = disc,
+            .requests = requests,
+            .files = files,
+            .done = done,
+            .user = user,
+        };
+        if (disc->backend->read_batch != NULL) {
+            success = disc->backend->read_batch(disc, reads, num_reads, read_files_done, &batch);
+        } else {
+            for (u32 i = 0; success && i < num_reads; i++) {
+                disc_read_t* read = &reads[i];
+                success = disc->backend->read(disc, read->offset, read->len, read->out_bytes)
+                    && read_files_done(read, &batch);
+            }
+        }
+    }
+
+    // A read the backend gave up waiting for may still write to its file's
+    // buffer, and its completion points at `reads`, so both are leaked.
+    bool is_any_in_flight = false;
+    for (u32 i = 0; i < num_reads; i++) {
+        if (reads[i].is_in_flight) {
+            files[reads[i].index] = (file_t) { 0 };
+            is_any_in_flight = true;
+        }
+    }
+
+    // Files that were never handed over still own their buffers.
+    for (u32 i = 0; i < count; i++) {
+        file_free(&files[i]);
+    }
+    free(files);
+    if (!is_any_in_flight) {
+        free(reads);
+    }
+    return success;
+}
+
+// file_free releases the buffer of a gathered file.
+void file_free(file_t* f)
+{
+    free(f->buffer);
+    *f = (file_t) { 0 };
+}
+
+// read_bytes copies the next `n` bytes of a file. Reads past the end of
+// the file read as zero.
+static void read_bytes(file_t* f, void* out, u64 n)
+{
+    if (f->offset + n <= f->len) {
+        memcpy(out, &f->data[f->offset], n);
+    }
+    f->offset += n;
+}
+
 u8 read_u8(file_t* f)
 {
-    u8 value;
-    memcpy(&value, &f->data[f->offset], sizeof(u8));
-    f->offset += sizeof(u8);
+    u8 value = 0;
+    read_bytes(f, &value, sizeof(u8));
     return value;
 }
 
 u16 read_u16(file_t* f)
 {
-    u16 value;
-    memcpy(&value, &f->data[f->offset], sizeof(u16));
-    f->offset += sizeof(u16);
+    u16 value = 0;
+    read_bytes(f, &value, sizeof(u16));
     return value;
 }
 
 u32 read_u32(file_t* f)
 {
-    u32 value;
-    memcpy(&value, &f->data[f->offset], sizeof(u32));
-    f->offset += sizeof(u32);
+    u32 value = 0;
+    read_bytes(f, &value, sizeof(u32));
     return value;
 }
 
 i8 read_i8(file_t* f)
 {
-    i8 value;
-    memcpy(&value, &f->data[f->offset], sizeof(i8));
-    f->offset += sizeof(i8);
+    i8 value = 0;
+    read_bytes(f, &value, sizeof(i8));
     return value;
 }
 
 i16 read_i16(file_t* f)
 {
-    i16 value;
-    memcpy(&value, &f->data[f->offset], sizeof(i16));
-    f->offset += sizeof(i16);
+    i16 value = 0;
+    read_bytes(f, &value, sizeof(i16));
     return value;
 }
 
 i32 read_i32(file_t* f)
 {
-    i32 value;
-    memcpy(&value, &f->data[f->offset], sizeof(i32));
-    f->offset += sizeof(i32);
+    i32 value = 0;
+    read_bytes(f, &value, sizeof(i32));
     return value;
 }
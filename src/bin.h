@@ -1,4 +1,4 @@
-// This file contains ways to read BIN files.
+// This file contains ways to read BIN files, and ISO and CSO images.
 #pragma once
 #include <stdio.h>
 
@@ -9,15 +9,111 @@
 #define SECTOR_SIZE 2048
 #define SECTOR_SIZE_RAW 2352
 #define SECTOR_HEADER_SIZE 24
+#define SECTOR_HEADER_SIZE_MODE1 16
 
-// file_t represents a file in a BIN file.
+// How sectors are stored in an image.
+enum DiscLayout {
+    DiscLayoutRaw,        // 2352-byte sectors, ie a BIN file.
+    DiscLayoutIso,        // 2048-byte sectors, ie an ISO file.
+    DiscLayoutCompressed, // Blocks deflated one at a time, ie a CSO file.
+};
+
+typedef struct disc_t disc_t;
+
+#define DISC_PATH_MAX 64
+
+// disc_file_t is a file in the file system of a disc.
 typedef struct {
-    u8 data[FILE_MAX_SIZE];
+    char path[DISC_PATH_MAX];
+    u32 sector;
+    u32 len;
+} disc_file_t;
+
+// disc_read_t is one read of a batch. `index` is for the caller.
+// `is_in_flight` is left set by a backend that gave up on a read the
+// kernel may still write to, so neither `out_bytes` nor the read itself
+// may be freed.
+typedef struct disc_read_t {
+    u64 offset;
+    u64 len;
+    u8* out_bytes;
+    u32 index;
+    bool is_in_flight;
+} disc_read_t;
+
+// disc_read_done_fn is called when a read of a batch has completed.
+// Returning false stops the batch.
+typedef bool (*disc_read_done_fn)(disc_read_t* read, void* user);
+
+// disc_backend_t is a way of reading bytes from a BIN file. Backends are
+// in io.c and are picked at runtime when the disc is opened.
+typedef struct {
+    const char* name;
+    bool (*open)(disc_t* disc);
+    void (*close)(disc_t* disc);
+    // read copies `len` bytes at byte `offset` of the image to `out_bytes`.
+    bool (*read)(disc_t* disc, u64 offset, u64 len, u8* out_bytes);
+    // read_batch does many reads at once, calling `done` for each as it
+    // completes. Optional, reads are done one at a time without it.
+    bool (*read_batch)(disc_t* disc, disc_read_t* reads, u32 count, disc_read_done_fn done, void* user);
+} disc_backend_t;
+
+// disc_t represents an open BIN file. It is opened once and shared by
+// every map load. Backends that keep the whole image in memory set `data`
+// so files can be read without a syscall per sector. Otherwise files are
+// read with one backend read per file.
+//
+// The layout of the image is detected when it is opened, so raw BIN,
+// cooked ISO and compressed CSO images can all be read.
+struct disc_t {
+    char* path;
+    const disc_backend_t* backend;
+    int fd;
+    FILE* file;
+    const u8* data;
+    void* backend_data;
+    u64 size;
+
+    u32 layout;
+    u32 sector_size;
+    u32 sector_header_size;
+    u32 num_sectors;
+
+    // Compressed images only.
+    u32* block_index;
+    u32 block_align;
+
+    // Every file on the disc, sorted by path. See iso.c.
+    disc_file_t* files;
+    u32 num_files;
+};
+
+// file_t is a read cursor over a file in a BIN file. The data is not
+// owned by the file_t unless it had to be gathered from several sectors,
+// in which case `buffer` holds it until file_free is called.
+typedef struct {
+    const u8* data;
     u64 len;
     u64 offset;
+    u8* buffer;
 } file_t;
 
-bool read_file(FILE* f, i32 sector, i32 size, file_t* out_file);
+// file_request_t is a file to read with read_files.
+typedef struct {
+    i32 sector;
+    i32 size;
+} file_request_t;
+
+// file_done_fn is called by read_files with each file that was read.
+// Returning false stops reading.
+typedef bool (*file_done_fn)(u32 index, file_t* file, void* user);
+
+bool disc_open(disc_t* disc, const char* filename, const disc_backend_t* backend);
+void disc_close(disc_t* disc);
+
+bool read_file(disc_t* disc, i32 sector, i32 size, file_t* out_file);
+bool read_files(disc_t* disc, const file_request_t* requests, u32 count, file_done_fn done, void* user);
+void file_free(file_t* f);
 
 u8 read_u8(file_t* f);
 u16 read_u16(file_t* f);
@@ -0,0 +1,292 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bin.h"
+#include "cache.h"
+#include "iso.h"
+#include "mesh.h"
+
+#define FNV_OFFSET 0xCBF29CE484222325ull
+#define FNV_PRIME 0x100000001B3ull
+
+static u64 fnv1a(u64 hash, const void* data, u64 len)
+{
+    const u8* bytes = data;
+    for (u64 i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+static u32 align_up(u32 value)
+{
+    return (value + CACHE_ALIGN - 1) & ~(CACHE_ALIGN - 1);
+}
+
+// make_dirs creates a directory and any missing parents.
+static bool make_dirs(char* path)
+{
+    for (char* p = path + 1; *p != '\0'; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            bool ok = mkdir(path, 0755) == 0 || errno == EEXIST;
+            *p = '/';
+            if (!ok) {
+                return false;
+            }
+        }
+    }
+    return mkdir(path, 0755) == 0 || errno == EEXIST;
+}
+
+// cache_path returns the file a map is cached in.
+static void cache_path(cache_t* cache, int map, char* out_path, u64 len)
+{
+    snprintf(out_path, len, "%s/%016llx-map%03d-v%d.bin",
+        cache->dir, cache->image_hash, map, MESH_DECODER_VERSION);
+}
+
+// cache_open picks the cache directory and works out which image is open.
+// The directory is HERETIC_CACHE_DIR, then $XDG_CACHE_HOME/heretic, then
+// ~/.cache/heretic. Setting HERETIC_CACHE_DIR to "" disables the cache.
+//
+// The image is identified by its volume descriptor and size instead of
+// hashing the whole image, which would cost more than it saves.
+bool cache_open(cache_t* cache, disc_t* disc)
+{
+    *cache = (cache_t) { 0 };
+
+    const char* dir = getenv("HERETIC_CACHE_DIR");
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    i32 n = 0;
+    if (dir != NULL) {
+        if (dir[0] == '\0') {
+            return false;
+        }
+        n = snprintf(cache->dir, sizeof(cache->dir), "%s", dir);
+    } else if (xdg != NULL && xdg[0] != '\0') {
+        n = snprintf(cache->dir, sizeof(cache->dir), "%s/heretic", xdg);
+    } else if (home != NULL) {
+        n = snprintf(cache->dir, sizeof(cache->dir), "%s/.cache/heretic", home);
+    } else {
+        return false;
+    }
+    if (n >= (i32)sizeof(cache->dir) || !make_dirs(cache->dir)) {
+        return false;
+    }
+
+    file_t pvd = { 0 };
+    if (!read_file(disc, ISO_PVD_SECTOR, SECTOR_SIZE, &pvd)) {
+        return false;
+    }
+    u64 hash = fnv1a(FNV_OFFSET, pvd.data, pvd.len);
+    hash = fnv1a(hash, &disc->size, sizeof(disc->size));
+    file_free(&pvd);
+
+    cache->image_hash = hash;
+    cache->enabled = true;
+    return true;
+}
+
+// is_layout_valid checks that a loaded mesh's geometries, patches, chunks and
+// variants only refer to what it has.
+static bool is_layout_valid(const mesh_t* mesh)
+{
+    for (u32 i = 0; i < mesh->num_geometries; i++) {
+        const geometry_t* geometry = &mesh->geometries[i];
+        if ((u64)geometry->first_vertex + geometry->num_vertices > mesh->num_vertices
+            || (u64)geometry->first_index + geometry->num_indices > mesh->num_indices
+            || geometry->num_vertices > MAX_VERTS
+            || (u64)geometry->first_patch + geometry->num_patches > mesh->num_patches
+            || (u64)geometry->first_chunk + geometry->num_chunks > mesh->num_chunks) {
+            return false;
+        }
+        for (u32 c = 0; c < geometry->num_chunks; c++) {
+            const chunk_t* chunk = &mesh->chunks[geometry->first_chunk + c];
+            if ((u64)chunk->first_index + chunk->num_indices > geometry->num_indices) {
+                return false;
+            }
+        }
+    }
+    for (u32 i = 0; i < mesh->num_patches; i++) {
+        const patch_t* patch = &mesh->patches[i];
+        if ((u64)patch->first_index + patch->num_indices > mesh->geometries[0].num_indices
+            || (u64)patch->source + patch->num_indices > mesh->num_indices) {
+            return false;
+        }
+    }
+    for (u32 i = 0; i < mesh->num_variants; i++) {
+        if (mesh->variants[i].geometry >= mesh->num_geometries || mesh->variants[i].texture >= mesh->num_textures) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// cache_load reads a map from the cache. It returns false on a miss, or if
+// the cache file doesn't match this image, map and decoder.
+//
+// The file stays mapped in the mesh, and its packed vertices, indices and
+// textures are used from the mapping as they are, ready to upload. Only
+// the small fixed arrays are copied out of it.
+bool cache_load(cache_t* cache, int map, mesh_t* mesh)
+{
+    if (!cache->enabled) {
+        return false;
+    }
+
+    char path[640];
+    cache_path(cache, map, path, sizeof(path));
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (u64)st.st_size < sizeof(cache_header_t)) {
+        close(fd);
+        return false;
+    }
+    u8* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    const cache_header_t* header = (const cache_header_t*)data;
+    u64 packed_vertices_size = (u64)header->num_vertices * sizeof(packed_vertex_t);
+    u64 indices_size = (u64)header->num_indices * sizeof(u16);
+    u64 textures_size = (u64)header->num_textures * TEXTURE_NUM_BYTES;
+    u64 variants_size = (u64)header->num_variants * sizeof(variant_t);
+    bool valid = header->magic == CACHE_MAGIC
+        && header->format_version == CACHE_FORMAT_VERSION
+        && header->decoder_version == MESH_DECODER_VERSION
+        && header->map == (u32)map
+        && header->image_hash == cache->image_hash
+        && header->num_vertices <= MAX_VERTS * MESH_MAX_GEOMETRIES
+        && header->num_indices <= MAX_INDICES * MESH_MAX_GEOMETRIES
+        && header->num_geometries >= 1 && header->num_geometries <= MESH_MAX_GEOMETRIES
+        && header->num_patches <= MESH_MAX_PATCHES
+        && header->num_chunks <= MESH_MAX_CHUNKS
+        && header->geometries[0].num_indices <= header->num_indices
+        && header->num_textures >= 1 && header->num_textures <= MESH_MAX_TEXTURES
+        && header->num_variants >= 1 && header->num_variants <= MESH_MAX_VARIANTS
+        && header->packed_vertices_offset % CACHE_ALIGN == 0
+        && header->indices_offset % CACHE_ALIGN == 0
+        && header->packed_vertices_offset + packed_vertices_size <= (u64)st.st_size
+        && header->indices_offset + indices_size <= (u64)st.st_size
+        && header->textures_offset + textures_size <= (u64)st.st_size
+        && header->variants_offset + variants_size <= (u64)st.st_size;
+    if (!valid) {
+        munmap(data, st.st_size);
+        return false;
+    }
+
+    // From here on the mesh owns the mapping, and resetting it unmaps it.
+    // Only the live indices, which change with the variant, need memory.
+    mesh->mapping = data;
+    mesh->mapping_size = st.st_size;
+    valid = mesh_alloc(mesh, 0, 0, header->geometries[0].num_indices);
+    if (valid) {
+        mesh->packed_vertices = (packed_vertex_t*)(data + header->packed_vertices_offset);
+        mesh->indices = (u16*)(data + header->indices_offset);
+        mesh_use_textures(mesh, data + header->textures_offset, header->num_textures);
+        memcpy(mesh->variants, data + header->variants_offset, variants_size);
+        memcpy(mesh->geometries, header->geometries, sizeof(mesh->geometries));
+        memcpy(mesh->patches, header->patches, sizeof(mesh->patches));
+        memcpy(mesh->chunks, header->chunks, sizeof(mesh->chunks));
+        mesh->num_vertices = header->num_vertices;
+        mesh->num_indices = header->num_indices;
+        mesh->num_geometries = header->num_geometries;
+        mesh->num_patches = header->num_patches;
+        mesh->num_chunks = header->num_chunks;
+        mesh->num_variants = header->num_variants;
+        mesh->center_transform = header->center_transform;
+        mesh->is_mesh_valid = header->is_mesh_valid;
+        mesh->is_texture_valid = header->is_texture_valid;
+        valid = is_layout_valid(mesh);
+    }
+    // A file that turns out to be bad leaves the mesh empty, as it was, so
+    // the map can still be decoded into it.
+    if (valid) {
+        mesh_set_variant(mesh, 0);
+    } else {
+        mesh_reset(mesh);
+    }
+    return valid;
+}
+
+// cache_store writes a map to the cache. It is written to a temporary file
+// first so a reader never sees a partial file.
+bool cache_store(cache_t* cache, int map, const mesh_t* mesh)
+{
+    if (!cache->enabled) {
+        return false;
+    }
+
+    u32 packed_vertices_size = mesh->num_vertices * sizeof(packed_vertex_t);
+    u32 indices_size = mesh->num_indices * sizeof(u16);
+    u32 textures_size = mesh->num_textures * TEXTURE_NUM_BYTES;
+    u32 variants_size = mesh->num_variants * sizeof(variant_t);
+    cache_header_t header = {
+        .magic = CACHE_MAGIC,
+        .format_version = CACHE_FORMAT_VERSION,
+        .decoder_version = MESH_DECODER_VERSION,
+        .map = map,
+        .image_hash = cache->image_hash,
+        .num_vertices = mesh->num_vertices,
+        .num_indices = mesh->num_indices,
+        .num_textures = mesh->num_textures,
+        .num_variants = mesh->num_variants,
+        .num_geometries = mesh->num_geometries,
+        .num_patches = mesh->num_patches,
+        .num_chunks = mesh->num_chunks,
+        .center_transform = mesh->center_transform,
+        .is_mesh_valid = mesh->is_mesh_valid,
+        .is_texture_valid = mesh->is_texture_valid,
+    };
+    memcpy(header.geometries, mesh->geometries, sizeof(header.geometries));
+    memcpy(header.patches, mesh->patches, sizeof(header.patches));
+    memcpy(header.chunks, mesh->chunks, sizeof(header.chunks));
+    header.packed_vertices_offset = align_up(sizeof(header));
+    header.indices_offset = align_up(header.packed_vertices_offset + packed_vertices_size);
+    header.textures_offset = align_up(header.indices_offset + indices_size);
+    header.variants_offset = align_up(header.textures_offset + textures_size);
+    u32 size = header.variants_offset + variants_size;
+
+    u8* data = calloc(1, size);
+    if (data == NULL) {
+        return false;
+    }
+    memcpy(data, &header, sizeof(header));
+    memcpy(data + header.packed_vertices_offset, mesh->packed_vertices, packed_vertices_size);
+    memcpy(data + header.indices_offset, mesh->indices, indices_size);
+    memcpy(data + header.textures_offset, mesh->textures, textures_size);
+    memcpy(data + header.variants_offset, mesh->variants, variants_size);
+
+    char path[640];
+    char tmp_path[660];
+    cache_path(cache, map, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+
+    FILE* f = fopen(tmp_path, "wb");
+    bool success = f != NULL && fwrite(data, 1, size, f) == size;
+    if (f != NULL) {
+        success = fclose(f) == 0 && success;
+    }
+    success = success && rename(tmp_path, path) == 0;
+    if (!success) {
+        unlink(tmp_path);
+    }
+
+    free(data);
+    return success;
+}
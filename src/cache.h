@@ -0,0 +1,54 @@
+// This file contains the on-disk cache of decoded maps.
+//
+// Each map is stored in its own file, named after the image it came from,
+// the map number and the decoder version, so a change to either misses.
+// Files are laid out so they can be mapped and used as is.
+#pragma once
+
+#include "bin.h"
+#include "defines.h"
+#include "mesh.h"
+
+#define CACHE_MAGIC 0x50414D48 // "HMAP"
+#define CACHE_FORMAT_VERSION 8
+#define CACHE_ALIGN 16
+
+// cache_t is the cache directory for one disc image.
+typedef struct {
+    char dir[512];
+    u64 image_hash;
+    bool enabled;
+} cache_t;
+
+// cache_header_t starts every cache file. Offsets are from the start of
+// the file.
+typedef struct {
+    u32 magic;
+    u32 format_version;
+    u32 decoder_version;
+    u32 map;
+    u64 image_hash;
+
+    u32 num_vertices;
+    u32 packed_vertices_offset;
+    u32 num_indices;
+    u32 indices_offset;
+    u32 num_textures;
+    u32 textures_offset;
+    u32 num_variants;
+    u32 variants_offset;
+
+    geometry_t geometries[MESH_MAX_GEOMETRIES];
+    u32 num_geometries;
+    patch_t patches[MESH_MAX_PATCHES];
+    u32 num_patches;
+    chunk_t chunks[MESH_MAX_CHUNKS];
+    u32 num_chunks;
+    vec3 center_transform;
+    u32 is_mesh_valid;
+    u32 is_texture_valid;
+} cache_header_t;
+
+bool cache_open(cache_t* cache, disc_t* disc);
+bool cache_load(cache_t* cache, int map, mesh_t* out_mesh);
+bool cache_store(cache_t* cache, int map, const mesh_t* mesh);
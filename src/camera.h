@@ -19,6 +19,10 @@
 #define CAMERA_MIN_LAT (-85.0f)
 #define CAMERA_MAX_LAT (85.0f)
 
+// How much further out than a bounding sphere's radius cam_frame puts the
+// camera, so the edges aren't right at the sides of the view.
+#define CAMERA_FRAME_MARGIN (1.25f)
+
 typedef struct {
     f32 distance;
     f32 fov;
@@ -82,6 +86,15 @@ static void cam_zoom(camera_t* cam, f32 d)
     cam->distance = clamp(CAMERA_MIN_DIST, cam->distance + d, CAMERA_MAX_DIST);
 }
 
+// cam_frame points the camera at the center of a bounding sphere and moves
+// it out far enough to see all of it.
+static void cam_frame(camera_t* cam, vec3 center, f32 radius)
+{
+    assert(cam);
+    cam->target = center;
+    cam->distance = clamp(radius * CAMERA_FRAME_MARGIN, CAMERA_MIN_DIST, CAMERA_MAX_DIST);
+}
+
 static vec3 _cam_euclidean(f32 latitude, f32 longitude)
 {
     const f32 lat = radians(latitude);
@@ -0,0 +1,635 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "decode.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#    define DECODE_X86 1
+#    include <immintrin.h>
+#endif
+
+// Each value is divided rather than multiplied by a reciprocal: 1/100
+// isn't exact in floating point, and dividing keeps the results identical
+// to the scalar readers, so decoded maps don't change.
+#define POSITION_DIVISOR 100.0f
+#define NORMAL_DIVISOR 4096.0f
+
+// raw_bounds_t is the min and max of each axis of packed positions.
+// Decoding keeps values in order, apart from flipping Y and Z, so the
+// decoded bounds match the min and max of the decoded positions exactly.
+typedef struct {
+    i16 min[3];
+    i16 max[3];
+} raw_bounds_t;
+
+static raw_bounds_t raw_bounds_empty(void)
+{
+    return (raw_bounds_t) {
+        .min = { INT16_MAX, INT16_MAX, INT16_MAX },
+        .max = { INT16_MIN, INT16_MIN, INT16_MIN },
+    };
+}
+
+static void raw_bounds_scalar(const u8* src, u32 count, raw_bounds_t* raw)
+{
+    for (u32 i = 0; i < count; i++) {
+        i16 v[3];
+        memcpy(v, &src[i * 6], sizeof(v));
+        for (u32 axis = 0; axis < 3; axis++) {
+            raw->min[axis] = v[axis] < raw->min[axis] ? v[axis] : raw->min[axis];
+            raw->max[axis] = v[axis] > raw->max[axis] ? v[axis] : raw->max[axis];
+        }
+    }
+}
+
+// grow_bounds grows `bounds` by the decoded `raw`, the same way
+// decode_scalar decodes each value.
+static void grow_bounds(const raw_bounds_t* raw, aabb_t* bounds)
+{
+    if (raw->min[0] > raw->max[0]) {
+        return;
+    }
+    aabb_t box = {
+        .min = {
+            (f32)raw->min[0] / POSITION_DIVISOR,
+            (f32)raw->max[1] / -POSITION_DIVISOR,
+            (f32)raw->max[2] / -POSITION_DIVISOR,
+        },
+        .max = {
+            (f32)raw->max[0] / POSITION_DIVISOR,
+            (f32)raw->min[1] / -POSITION_DIVISOR,
+            (f32)raw->min[2] / -POSITION_DIVISOR,
+        },
+    };
+    *bounds = aabb_merge(*bounds, box);
+}
+
+static void decode_scalar(const u8* src, u32 count, vec3* out, f32 divisor)
+{
+    for (u32 i = 0; i < count; i++) {
+        i16 v[3];
+        memcpy(v, &src[i * 6], sizeof(v));
+        out[i] = (vec3) {
+            .x = (f32)v[0] / divisor,
+            .y = (f32)v[1] / -divisor,
+            .z = (f32)v[2] / -divisor,
+        };
+    }
+}
+
+static void positions_scalar(const u8* src, u32 count, vec3* out)
+{
+    decode_scalar(src, count, out, POSITION_DIVISOR);
+}
+
+static void normals_scalar(const u8* src, u32 count, vec3* out)
+{
+    decode_scalar(src, count, out, NORMAL_DIVISOR);
+}
+
+static void bounded_positions_scalar(const u8* src, u32 count, vec3* out, aabb_t* bounds)
+{
+    raw_bounds_t raw = raw_bounds_empty();
+    raw_bounds_scalar(src, count, &raw);
+    decode_scalar(src, count, out, POSITION_DIVISOR);
+    grow_bounds(&raw, bounds);
+}
+
+const vertex_decoder_t vertex_decoder_scalar = {
+    .name = "scalar",
+    .positions = positions_scalar,
+    .normals = normals_scalar,
+    .bounded_positions = bounded_positions_scalar,
+};
+
+#ifdef DECODE_X86
+
+// 8 triplets are 24 values, so the x,y,z pattern of the divisors repeats
+// every 3 vectors of 4, or 3 vectors of 8.
+
+// raw_bounds_lanes adds the min and max of 8 packed values, the first of
+// which is on `axis`.
+static void raw_bounds_lanes(__m128i lo, __m128i hi, u32 axis, raw_bounds_t* raw)
+{
+    i16 l[8];
+    i16 h[8];
+    _mm_storeu_si128((__m128i*)l, lo);
+    _mm_storeu_si128((__m128i*)h, hi);
+    for (u32 i = 0; i < 8; i++) {
+        u32 a = (axis + i) % 3;
+        raw->min[a] = l[i] < raw->min[a] ? l[i] : raw->min[a];
+        raw->max[a] = h[i] > raw->max[a] ? h[i] : raw->max[a];
+    }
+}
+
+// With `raw`, the min and max of the packed values are kept too. Each of
+// the 3 loads starts on a different axis, so each gets its own.
+static void decode_sse2(const u8* src, u32 count, vec3* out, f32 divisor, raw_bounds_t* raw)
+{
+    const __m128 d0 = _mm_setr_ps(divisor, -divisor, -divisor, divisor);
+    const __m128 d1 = _mm_setr_ps(-divisor, -divisor, divisor, -divisor);
+    const __m128 d2 = _mm_setr_ps(-divisor, divisor, -divisor, -divisor);
+    f32* dst = (f32*)out;
+    __m128i lo[3] = { _mm_set1_epi16(INT16_MAX), _mm_set1_epi16(INT16_MAX), _mm_set1_epi16(INT16_MAX) };
+    __m128i hi[3] = { _mm_set1_epi16(INT16_MIN), _mm_set1_epi16(INT16_MIN), _mm_set1_epi16(INT16_MIN) };
+
+    u32 i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const u8* s = &src[i * 6];
+        __m128i a = _mm_loadu_si128((const __m128i*)(s + 0));
+        __m128i b = _mm_loadu_si128((const __m128i*)(s + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(s + 32));
+        if (raw != NULL) {
+            lo[0] = _mm_min_epi16(lo[0], a);
+            lo[1] = _mm_min_epi16(lo[1], b);
+            lo[2] = _mm_min_epi16(lo[2], c);
+            hi[0] = _mm_max_epi16(hi[0], a);
+            hi[1] = _mm_max_epi16(hi[1], b);
+            hi[2] = _mm_max_epi16(hi[2], c);
+        }
+
+        // Sign extend by moving each i16 to the top of an i32 and shifting
+        // it back down.
+        __m128 f0 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(a, a), 16));
+        __m128 f1 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(a, a), 16));
+        __m128 f2 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(b, b), 16));
+        __m128 f3 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(b, b), 16));
+        __m128 f4 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(c, c), 16));
+        __m128 f5 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(c, c), 16));
+
+        f32* d = &dst[i * 3];
+        _mm_storeu_ps(d + 0, _mm_div_ps(f0, d0));
+        _mm_storeu_ps(d + 4, _mm_div_ps(f1, d1));
+        _mm_storeu_ps(d + 8, _mm_div_ps(f2, d2));
+        _mm_storeu_ps(d + 12, _mm_div_ps(f3, d0));
+        _mm_storeu_ps(d + 16, _mm_div_ps(f4, d1));
+        _mm_storeu_ps(d + 20, _mm_div_ps(f5, d2));
+    }
+    decode_scalar(&src[i * 6], count - i, &out[i], divisor);
+
+    if (raw != NULL) {
+        raw_bounds_lanes(lo[0], hi[0], 0, raw);
+        raw_bounds_lanes(lo[1], hi[1], 2, raw);
+        raw_bounds_lanes(lo[2], hi[2], 1, raw);
+        raw_bounds_scalar(&src[i * 6], count - i, raw);
+    }
+}
+
+static void positions_sse2(const u8* src, u32 count, vec3* out)
+{
+    decode_sse2(src, count, out, POSITION_DIVISOR, NULL);
+}
+
+static void normals_sse2(const u8* src, u32 count, vec3* out)
+{
+    decode_sse2(src, count, out, NORMAL_DIVISOR, NULL);
+}
+
+static void bounded_positions_sse2(const u8* src, u32 count, vec3* out, aabb_t* bounds)
+{
+    raw_bounds_t raw = raw_bounds_empty();
+    decode_sse2(src, count, out, POSITION_DIVISOR, &raw);
+    grow_bounds(&raw, bounds);
+}
+
+__attribute__((target("avx2"))) static void decode_avx2(const u8* src, u32 count, vec3* out, f32 divisor, raw_bounds_t* raw)
+{
+    const f32 x = divisor;
+    const f32 y = -divisor;
+    const __m256 d0 = _mm256_setr_ps(x, y, y, x, y, y, x, y);
+    const __m256 d1 = _mm256_setr_ps(y, x, y, y, x, y, y, x);
+    const __m256 d2 = _mm256_setr_ps(y, y, x, y, y, x, y, y);
+    f32* dst = (f32*)out;
+    __m128i lo[3] = { _mm_set1_epi16(INT16_MAX), _mm_set1_epi16(INT16_MAX), _mm_set1_epi16(INT16_MAX) };
+    __m128i hi[3] = { _mm_set1_epi16(INT16_MIN), _mm_set1_epi16(INT16_MIN), _mm_set1_epi16(INT16_MIN) };
+
+    u32 i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const u8* s = &src[i * 6];
+        __m128i pa = _mm_loadu_si128((const __m128i*)(s + 0));
+        __m128i pb = _mm_loadu_si128((const __m128i*)(s + 16));
+        __m128i pc = _mm_loadu_si128((const __m128i*)(s + 32));
+        if (raw != NULL) {
+            lo[0] = _mm_min_epi16(lo[0], pa);
+            lo[1] = _mm_min_epi16(lo[1], pb);
+            lo[2] = _mm_min_epi16(lo[2], pc);
+            hi[0] = _mm_max_epi16(hi[0], pa);
+            hi[1] = _mm_max_epi16(hi[1], pb);
+            hi[2] = _mm_max_epi16(hi[2], pc);
+        }
+        __m256i a = _mm256_cvtepi16_epi32(pa);
+        __m256i b = _mm256_cvtepi16_epi32(pb);
+        __m256i c = _mm256_cvtepi16_epi32(pc);
+
+        f32* d = &dst[i * 3];
+        _mm256_storeu_ps(d + 0, _mm256_div_ps(_mm256_cvtepi32_ps(a), d0));
+        _mm256_storeu_ps(d + 8, _mm256_div_ps(_mm256_cvtepi32_ps(b), d1));
+        _mm256_storeu_ps(d + 16, _mm256_div_ps(_mm256_cvtepi32_ps(c), d2));
+    }
+    decode_scalar(&src[i * 6], count - i, &out[i], divisor);
+
+    if (raw != NULL) {
+        raw_bounds_lanes(lo[0], hi[0], 0, raw);
+        raw_bounds_lanes(lo[1], hi[1], 2, raw);
+        raw_bounds_lanes(lo[2], hi[2], 1, raw);
+        raw_bounds_scalar(&src[i * 6], count - i, raw);
+    }
+}
+
+static void positions_avx2(const u8* src, u32 count, vec3* out)
+{
+    decode_avx2(src, count, out, POSITION_DIVISOR, NULL);
+}
+
+static void normals_avx2(const u8* src, u32 count, vec3* out)
+{
+    decode_avx2(src, count, out, NORMAL_DIVISOR, NULL);
+}
+
+static void bounded_positions_avx2(const u8* src, u32 count, vec3* out, aabb_t* bounds)
+{
+    raw_bounds_t raw = raw_bounds_empty();
+    decode_avx2(src, count, out, POSITION_DIVISOR, &raw);
+    grow_bounds(&raw, bounds);
+}
+
+const vertex_decoder_t vertex_decoder_sse2 = {
+    .name = "sse2",
+    .positions = positions_sse2,
+    .normals = normals_sse2,
+    .bounded_positions = bounded_positions_sse2,
+};
+
+const vertex_decoder_t vertex_decoder_avx2 = {
+    .name = "avx2",
+    .positions = positions_avx2,
+    .normals = normals_avx2,
+    .bounded_positions = bounded_positions_avx2,
+};
+
+#else
+
+// Without x86 the SIMD decoders are the scalar ones.
+const vertex_decoder_t vertex_decoder_sse2 = {
+    .name = "sse2",
+    .positions = positions_scalar,
+    .normals = normals_scalar,
+    .bounded_positions = bounded_positions_scalar,
+};
+
+const vertex_decoder_t vertex_decoder_avx2 = {
+    .name = "avx2",
+    .positions = positions_scalar,
+    .normals = normals_scalar,
+    .bounded_positions = bounded_positions_scalar,
+};
+
+#endif
+
+const vertex_decoder_t* vertex_decoders[] = {
+    &vertex_decoder_scalar,
+    &vertex_decoder_sse2,
+    &vertex_decoder_avx2,
+    NULL,
+};
+
+bool vertex_decoder_supported(const vertex_decoder_t* decoder)
+{
+#ifdef DECODE_X86
+    if (decoder == &vertex_decoder_avx2) {
+        return __builtin_cpu_supports("avx2");
+    }
+    if (decoder == &vertex_decoder_sse2) {
+        return __builtin_cpu_supports("sse2");
+    }
+    return true;
+#else
+    return decoder == &vertex_decoder_scalar;
+#endif
+}
+
+// vertex_decoder_best returns the fastest decoder the CPU supports.
+const vertex_decoder_t* vertex_decoder_best(void)
+{
+    if (vertex_decoder_supported(&vertex_decoder_avx2)) {
+        return &vertex_decoder_avx2;
+    }
+    if (vertex_decoder_supported(&vertex_decoder_sse2)) {
+        return &vertex_decoder_sse2;
+    }
+    return &vertex_decoder_scalar;
+}
+
+// decode_positions decodes `count` packed positions from `src`.
+void decode_positions(const u8* src, u32 count, vec3* out)
+{
+    vertex_decoder_best()->positions(src, count, out);
+}
+
+// decode_normals decodes `count` packed normals from `src`.
+void decode_normals(const u8* src, u32 count, vec3* out)
+{
+    vertex_decoder_best()->normals(src, count, out);
+}
+
+static void indices_scalar(const u8* src, u32 count, u8* out)
+{
+    for (u32 i = 0; i < count; i++) {
+        out[i * 2 + 0] = src[i] & 0x0F;
+        out[i * 2 + 1] = src[i] >> 4;
+    }
+}
+
+static void rgba_scalar(const u8* src, u32 count, const u8* palette, u8* out)
+{
+    for (u32 i = 0; i < count; i++) {
+        memcpy(&out[i * 8 + 0], &palette[(src[i] & 0x0F) * 4], 4);
+        memcpy(&out[i * 8 + 4], &palette[(src[i] >> 4) * 4], 4);
+    }
+}
+
+// Only black is transparent.
+static void palette_scalar(const u8* src, u32 count, u8* out)
+{
+    for (u32 i = 0; i < count; i++) {
+        u16 c;
+        memcpy(&c, &src[i * 2], sizeof(c));
+        out[i * 4 + 0] = (c & 0x001F) << 3;
+        out[i * 4 + 1] = (c & 0x03E0) >> 2;
+        out[i * 4 + 2] = (c & 0x7C00) >> 7;
+        out[i * 4 + 3] = c == 0 ? 0x00 : 0xFF;
+    }
+}
+
+const texture_decoder_t texture_decoder_scalar = {
+    .name = "scalar",
+    .indices = indices_scalar,
+    .rgba = rgba_scalar,
+    .palette = palette_scalar,
+};
+
+#ifdef DECODE_X86
+
+// The palette is split into a vector per channel, so a byte shuffle with
+// the indices looks up one channel of 16 pixels at once.
+typedef struct {
+    u8 r[16];
+    u8 g[16];
+    u8 b[16];
+    u8 a[16];
+} palette_planes_t;
+
+static palette_planes_t split_palette(const u8* palette)
+{
+    palette_planes_t planes;
+    for (u32 i = 0; i < 16; i++) {
+        planes.r[i] = palette[i * 4 + 0];
+        planes.g[i] = palette[i * 4 + 1];
+        planes.b[i] = palette[i * 4 + 2];
+        planes.a[i] = palette[i * 4 + 3];
+    }
+    return planes;
+}
+
+// unpack_sse2 turns 16 bytes into 32 indices, in order across lo and hi.
+static inline void unpack_sse2(__m128i v, __m128i* lo, __m128i* hi)
+{
+    const __m128i mask = _mm_set1_epi8(0x0F);
+    __m128i left = _mm_and_si128(v, mask);
+    __m128i right = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+    *lo = _mm_unpacklo_epi8(left, right);
+    *hi = _mm_unpackhi_epi8(left, right);
+}
+
+__attribute__((target("ssse3"))) static void indices_ssse3(const u8* src, u32 count, u8* out)
+{
+    u32 i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i lo, hi;
+        unpack_sse2(_mm_loadu_si128((const __m128i*)&src[i]), &lo, &hi);
+        _mm_storeu_si128((__m128i*)&out[i * 2 + 0], lo);
+        _mm_storeu_si128((__m128i*)&out[i * 2 + 16], hi);
+    }
+    indices_scalar(&src[i], count - i, &out[i * 2]);
+}
+
+// store_rgba_ssse3 looks up 16 indices and writes 16 pixels.
+__attribute__((target("ssse3"))) static inline void store_rgba_ssse3(const palette_planes_t* planes, __m128i indices, u8* out)
+{
+    __m128i r = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)planes->r), indices);
+    __m128i g = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)planes->g), indices);
+    __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)planes->b), indices);
+    __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)planes->a), indices);
+    __m128i rg_lo = _mm_unpacklo_epi8(r, g);
+    __m128i rg_hi = _mm_unpackhi_epi8(r, g);
+    __m128i ba_lo = _mm_unpacklo_epi8(b, a);
+    __m128i ba_hi = _mm_unpackhi_epi8(b, a);
+    _mm_storeu_si128((__m128i*)&out[0], _mm_unpacklo_epi16(rg_lo, ba_lo));
+    _mm_storeu_si128((__m128i*)&out[16], _mm_unpackhi_epi16(rg_lo, ba_lo));
+    _mm_storeu_si128((__m128i*)&out[32], _mm_unpacklo_epi16(rg_hi, ba_hi));
+    _mm_storeu_si128((__m128i*)&out[48], _mm_unpackhi_epi16(rg_hi, ba_hi));
+}
+
+__attribute__((target("ssse3"))) static void rgba_ssse3(const u8* src, u32 count, const u8* palette, u8* out)
+{
+    palette_planes_t planes = split_palette(palette);
+
+    u32 i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i lo, hi;
+        unpack_sse2(_mm_loadu_si128((const __m128i*)&src[i]), &lo, &hi);
+        store_rgba_ssse3(&planes, lo, &out[i * 8 + 0]);
+        store_rgba_ssse3(&planes, hi, &out[i * 8 + 64]);
+    }
+    rgba_scalar(&src[i], count - i, palette, &out[i * 8]);
+}
+
+// Colours are split into channels in 16-bit lanes, red and blue in the
+// low bytes and green and alpha in the high bytes, then interleaved.
+
+__attribute__((target("ssse3"))) static void palette_ssse3(const u8* src, u32 count, u8* out)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha = _mm_set1_epi16((i16)0xFF00);
+
+    u32 i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i c = _mm_loadu_si128((const __m128i*)&src[i * 2]);
+        __m128i r = _mm_slli_epi16(_mm_and_si128(c, _mm_set1_epi16(0x001F)), 3);
+        __m128i g = _mm_slli_epi16(_mm_and_si128(c, _mm_set1_epi16(0x03E0)), 6);
+        __m128i b = _mm_srli_epi16(_mm_and_si128(c, _mm_set1_epi16(0x7C00)), 7);
+        __m128i a = _mm_andnot_si128(_mm_cmpeq_epi16(c, zero), alpha);
+        __m128i rg = _mm_or_si128(r, g);
+        __m128i ba = _mm_or_si128(b, a);
+        _mm_storeu_si128((__m128i*)&out[i * 4 + 0], _mm_unpacklo_epi16(rg, ba));
+        _mm_storeu_si128((__m128i*)&out[i * 4 + 16], _mm_unpackhi_epi16(rg, ba));
+    }
+    palette_scalar(&src[i * 2], count - i, &out[i * 4]);
+}
+
+__attribute__((target("avx2"))) static void palette_avx2(const u8* src, u32 count, u8* out)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i alpha = _mm256_set1_epi16((i16)0xFF00);
+
+    u32 i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i c = _mm256_loadu_si256((const __m256i*)&src[i * 2]);
+        __m256i r = _mm256_slli_epi16(_mm256_and_si256(c, _mm256_set1_epi16(0x001F)), 3);
+        __m256i g = _mm256_slli_epi16(_mm256_and_si256(c, _mm256_set1_epi16(0x03E0)), 6);
+        __m256i b = _mm256_srli_epi16(_mm256_and_si256(c, _mm256_set1_epi16(0x7C00)), 7);
+        __m256i a = _mm256_andnot_si256(_mm256_cmpeq_epi16(c, zero), alpha);
+        __m256i rg = _mm256_or_si256(r, g);
+        __m256i ba = _mm256_or_si256(b, a);
+        __m256i lo = _mm256_unpacklo_epi16(rg, ba);
+        __m256i hi = _mm256_unpackhi_epi16(rg, ba);
+        _mm256_storeu_si256((__m256i*)&out[i * 4 + 0], _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i*)&out[i * 4 + 32], _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    palette_scalar(&src[i * 2], count - i, &out[i * 4]);
+}
+
+// AVX2 unpacks within each 128-bit lane, so results are put back in order
+// with a lane permute before they are stored.
+
+__attribute__((target("avx2"))) static void indices_avx2(const u8* src, u32 count, u8* out)
+{
+    const __m256i mask = _mm256_set1_epi8(0x0F);
+
+    u32 i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)&src[i]);
+        __m256i left = _mm256_and_si256(v, mask);
+        __m256i right = _mm256_and_si256(_mm256_srli_epi16(v, 4), mask);
+        __m256i lo = _mm256_unpacklo_epi8(left, right);
+        __m256i hi = _mm256_unpackhi_epi8(left, right);
+        _mm256_storeu_si256((__m256i*)&out[i * 2 + 0], _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i*)&out[i * 2 + 32], _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    indices_scalar(&src[i], count - i, &out[i * 2]);
+}
+
+__attribute__((target("avx2"))) static void rgba_avx2(const u8* src, u32 count, const u8* palette, u8* out)
+{
+    palette_planes_t planes = split_palette(palette);
+    const __m256i pr = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)planes.r));
+    const __m256i pg = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)planes.g));
+    const __m256i pb = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)planes.b));
+    const __m256i pa = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)planes.a));
+
+    u32 i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i lo, hi;
+        unpack_sse2(_mm_loadu_si128((const __m128i*)&src[i]), &lo, &hi);
+        __m256i indices = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+        __m256i r = _mm256_shuffle_epi8(pr, indices);
+        __m256i g = _mm256_shuffle_epi8(pg, indices);
+        __m256i b = _mm256_shuffle_epi8(pb, indices);
+        __m256i a = _mm256_shuffle_epi8(pa, indices);
+        __m256i rg_lo = _mm256_unpacklo_epi8(r, g);
+        __m256i rg_hi = _mm256_unpackhi_epi8(r, g);
+        __m256i ba_lo = _mm256_unpacklo_epi8(b, a);
+        __m256i ba_hi = _mm256_unpackhi_epi8(b, a);
+
+        // Pixels 0-3 and 16-19, 4-7 and 20-23, 8-11 and 24-27, 12-15 and 28-31.
+        __m256i p0 = _mm256_unpacklo_epi16(rg_lo, ba_lo);
+        __m256i p1 = _mm256_unpackhi_epi16(rg_lo, ba_lo);
+        __m256i p2 = _mm256_unpacklo_epi16(rg_hi, ba_hi);
+        __m256i p3 = _mm256_unpackhi_epi16(rg_hi, ba_hi);
+
+        u8* d = &out[i * 8];
+        _mm256_storeu_si256((__m256i*)&d[0], _mm256_permute2x128_si256(p0, p1, 0x20));
+        _mm256_storeu_si256((__m256i*)&d[32], _mm256_permute2x128_si256(p2, p3, 0x20));
+        _mm256_storeu_si256((__m256i*)&d[64], _mm256_permute2x128_si256(p0, p1, 0x31));
+        _mm256_storeu_si256((__m256i*)&d[96], _mm256_permute2x128_si256(p2, p3, 0x31));
+    }
+    rgba_scalar(&src[i], count - i, palette, &out[i * 8]);
+}
+
+const texture_decoder_t texture_decoder_ssse3 = {
+    .name = "ssse3",
+    .indices = indices_ssse3,
+    .rgba = rgba_ssse3,
+    .palette = palette_ssse3,
+};
+
+const texture_decoder_t texture_decoder_avx2 = {
+    .name = "avx2",
+    .indices = indices_avx2,
+    .rgba = rgba_avx2,
+    .palette = palette_avx2,
+};
+
+#else
+
+// Without x86 the SIMD decoders are the scalar ones.
+const texture_decoder_t texture_decoder_ssse3 = {
+    .name = "ssse3",
+    .indices = indices_scalar,
+    .rgba = rgba_scalar,
+    .palette = palette_scalar,
+};
+
+const texture_decoder_t texture_decoder_avx2 = {
+    .name = "avx2",
+    .indices = indices_scalar,
+    .rgba = rgba_scalar,
+    .palette = palette_scalar,
+};
+
+#endif
+
+const texture_decoder_t* texture_decoders[] = {
+    &texture_decoder_scalar,
+    &texture_decoder_ssse3,
+    &texture_decoder_avx2,
+    NULL,
+};
+
+bool texture_decoder_supported(const texture_decoder_t* decoder)
+{
+#ifdef DECODE_X86
+    if (decoder == &texture_decoder_avx2) {
+        return __builtin_cpu_supports("avx2");
+    }
+    if (decoder == &texture_decoder_ssse3) {
+        return __builtin_cpu_supports("ssse3");
+    }
+    return true;
+#else
+    return decoder == &texture_decoder_scalar;
+#endif
+}
+
+// texture_decoder_best returns the fastest decoder the CPU supports.
+const texture_decoder_t* texture_decoder_best(void)
+{
+    if (texture_decoder_supported(&texture_decoder_avx2)) {
+        return &texture_decoder_avx2;
+    }
+    if (texture_decoder_supported(&texture_decoder_ssse3)) {
+        return &texture_decoder_ssse3;
+    }
+    return &texture_decoder_scalar;
+}
+
+// decode_texture_indices unpacks `count` bytes of a texture into a
+// palette index per byte.
+void decode_texture_indices(const u8* src, u32 count, u8* out)
+{
+    texture_decoder_best()->indices(src, count, out);
+}
+
+// decode_texture_rgba unpacks `count` bytes of a texture into RGBA8
+// pixels using one 16 colour palette.
+void decode_texture_rgba(const u8* src, u32 count, const u8* palette, u8* out)
+{
+    texture_decoder_best()->rgba(src, count, palette, out);
+}
+
+// decode_palette converts `count` RGB15 colours to RGBA8.
+void decode_palette(const u8* src, u32 count, u8* out)
+{
+    texture_decoder_best()->palette(src, count, out);
+}
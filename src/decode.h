@@ -0,0 +1,62 @@
+// This file contains bulk decoders for the packed fixed point data in map
+// files, with SIMD versions where the CPU has them.
+//
+// Positions are i16 triplets in 1/100ths and normals are 1.3.12 i16
+// triplets. Both have Y and Z flipped. The results match read_position
+// and read_normal exactly.
+//
+// Positions can be decoded with their bounds, found with min and max on
+// the packed values while they are decoded.
+//
+// Textures are 4-bit palette indices, 2 pixels per byte with the left
+// pixel in the low nibble. The GPU unpacks them itself; these are for
+// anything that needs a pixel per byte, or colours. Palette colours are
+// RGB15 and are converted to RGBA8 the same way as read_rgb15.
+#pragma once
+
+#include "defines.h"
+#include "maths.h"
+
+typedef struct {
+    const char* name;
+    void (*positions)(const u8* src, u32 count, vec3* out);
+    void (*normals)(const u8* src, u32 count, vec3* out);
+    // bounded_positions decodes positions and grows `bounds` to hold them.
+    void (*bounded_positions)(const u8* src, u32 count, vec3* out, aabb_t* bounds);
+} vertex_decoder_t;
+
+extern const vertex_decoder_t vertex_decoder_scalar;
+extern const vertex_decoder_t vertex_decoder_sse2;
+extern const vertex_decoder_t vertex_decoder_avx2;
+
+// NULL-terminated list of every decoder, for benchmarks.
+extern const vertex_decoder_t* vertex_decoders[];
+
+const vertex_decoder_t* vertex_decoder_best(void);
+bool vertex_decoder_supported(const vertex_decoder_t* decoder);
+void decode_positions(const u8* src, u32 count, vec3* out);
+void decode_normals(const u8* src, u32 count, vec3* out);
+
+typedef struct {
+    const char* name;
+    // indices unpacks `count` bytes into 2 * `count` palette indices.
+    void (*indices)(const u8* src, u32 count, u8* out);
+    // rgba unpacks `count` bytes into 2 * `count` RGBA8 pixels, looking
+    // each index up in a palette of 16 colours.
+    void (*rgba)(const u8* src, u32 count, const u8* palette, u8* out);
+    // palette converts `count` RGB15 colours to RGBA8.
+    void (*palette)(const u8* src, u32 count, u8* out);
+} texture_decoder_t;
+
+extern const texture_decoder_t texture_decoder_scalar;
+extern const texture_decoder_t texture_decoder_ssse3;
+extern const texture_decoder_t texture_decoder_avx2;
+
+// NULL-terminated list of every decoder, for benchmarks.
+extern const texture_decoder_t* texture_decoders[];
+
+const texture_decoder_t* texture_decoder_best(void);
+bool texture_decoder_supported(const texture_decoder_t* decoder);
+void decode_texture_indices(const u8* src, u32 count, u8* out);
+void decode_texture_rgba(const u8* src, u32 count, const u8* palette, u8* out);
+void decode_palette(const u8* src, u32 count, u8* out);
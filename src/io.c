@@ -0,0 +1,412 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifdef HAVE_LIBURING
+#    include <liburing.h>
+#endif
+
+#include "bin.h"
+#include "io.h"
+
+// Number of entries in the io_uring submission queue.
+#define URING_QUEUE_DEPTH 64
+
+const disc_backend_t* const disc_backends[] = {
+    &disc_backend_stdio,
+    &disc_backend_mmap,
+    &disc_backend_pread,
+    &disc_backend_uring,
+    &disc_backend_memory,
+    NULL,
+};
+
+// disc_backend_find returns the backend called `name`, or NULL.
+const disc_backend_t* disc_backend_find(const char* name)
+{
+    for (i32 i = 0; disc_backends[i] != NULL; i++) {
+        if (strcmp(disc_backends[i]->name, name) == 0) {
+            return disc_backends[i];
+        }
+    }
+    return NULL;
+}
+
+//
+// pread: one pread per read, looping only on short reads.
+//
+
+static bool pread_open(disc_t* disc)
+{
+    (void)disc;
+    return true;
+}
+
+static void pread_close(disc_t* disc)
+{
+    (void)disc;
+}
+
+static bool pread_read(disc_t* disc, u64 offset, u64 len, u8* out_bytes)
+{
+    while (len > 0) {
+        ssize_t n = pread(disc->fd, out_bytes, len, offset);
+        if (n <= 0) {
+            return false;
+        }
+        out_bytes += n;
+        offset += n;
+        len -= n;
+    }
+    return true;
+}
+
+const disc_backend_t disc_backend_pread = {
+    .name = "pread",
+    .open = pread_open,
+    .close = pread_close,
+    .read = pread_read,
+};
+
+//
+// stdio: fseek and fread through a FILE.
+//
+
+static bool stdio_open(disc_t* disc)
+{
+    disc->file = fopen(disc->path, "rb");
+    return disc->file != NULL;
+}
+
+static void stdio_close(disc_t* disc)
+{
+    fclose(disc->file);
+    disc->file = NULL;
+}
+
+static bool stdio_read(disc_t* disc, u64 offset, u64 len, u8* out_bytes)
+{
+    if (fseeko(disc->file, offset, SEEK_SET) != 0) {
+        return false;
+    }
+    return fread(out_bytes, sizeof(u8), len, disc->file) == len;
+}
+
+const disc_backend_t disc_backend_stdio = {
+    .name = "stdio",
+    .open = stdio_open,
+    .close = stdio_close,
+    .read = stdio_read,
+};
+
+//
+// mmap: the whole image is mapped. Falls back to pread if mapping fails.
+//
+
+static bool mmap_open(disc_t* disc)
+{
+    void* data = mmap(NULL, disc->size, PROT_READ, MAP_PRIVATE, disc->fd, 0);
+    if (data != MAP_FAILED) {
+        disc->data = data;
+    }
+    return true;
+}
+
+static void mmap_close(disc_t* disc)
+{
+    if (disc->data != NULL) {
+        munmap((void*)disc->data, disc->size);
+        disc->data = NULL;
+    }
+}
+
+static bool memory_read(disc_t* disc, u64 offset, u64 len, u8* out_bytes)
+{
+    if (disc->data == NULL) {
+        return pread_read(disc, offset, len, out_bytes);
+    }
+    if (offset + len > disc->size) {
+        return false;
+    }
+    memcpy(out_bytes, disc->data + offset, len);
+    return true;
+}
+
+const disc_backend_t disc_backend_mmap = {
+    .name = "mmap",
+    .open = mmap_open,
+    .close = mmap_close,
+    .read = memory_read,
+};
+
+//
+// memory: the whole image is read into memory when it is opened.
+//
+
+static bool memory_open(disc_t* disc)
+{
+    u8* data = malloc(disc->size);
+    if (data == NULL) {
+        return false;
+    }
+    if (!pread_read(disc, 0, disc->size, data)) {
+        free(data);
+        return false;
+    }
+    disc->data = data;
+    return true;
+}
+
+static void memory_close(disc_t* disc)
+{
+    free((void*)disc->data);
+    disc->data = NULL;
+}
+
+const disc_backend_t disc_backend_memory = {
+    .name = "memory",
+    .open = memory_open,
+    .close = memory_close,
+    .read = memory_read,
+};
+
+//
+// uring: reads are submitted to an io_uring. Only available when built
+// with liburing.
+//
+
+#ifdef HAVE_LIBURING
+
+// uring_t is the backend data of the uring backend. A ring that fails in
+// a way that may leave reads in flight is marked broken and never used
+// again, every read after that is done with pread.
+typedef struct {
+    struct io_uring ring;
+    bool is_broken;
+} uring_t;
+
+static bool uring_open(disc_t* disc)
+{
+    uring_t* uring = calloc(1, sizeof(uring_t));
+    if (uring == NULL) {
+        return false;
+    }
+    if (io_uring_queue_init(URING_QUEUE_DEPTH, &uring->ring, 0) != 0) {
+        free(uring);
+        return false;
+    }
+    disc->backend_data = uring;
+    return true;
+}
+
+static void uring_close(disc_t* disc)
+{
+    uring_t* uring = disc->backend_data;
+    io_uring_queue_exit(&uring->ring);
+    free(uring);
+    disc->backend_data = NULL;
+}
+
+// uring_submit hands the queued reads to the kernel, retrying while it is
+// busy. Any other failure breaks the ring.
+static bool uring_submit(uring_t* uring)
+{
+    i32 err;
+    do {
+        err = io_uring_submit(&uring->ring);
+    } while (err == -EINTR || err == -EAGAIN || err == -EBUSY);
+    if (err < 0) {
+        printf("io_uring submit failed: %s\n", strerror(-err));
+        uring->is_broken = true;
+        return false;
+    }
+    return true;
+}
+
+// uring_wait waits for the next completion, retrying while interrupted.
+// Any other failure breaks the ring.
+static bool uring_wait(uring_t* uring, struct io_uring_cqe** out_cqe)
+{
+    i32 err;
+    do {
+        err = io_uring_wait_cqe(&uring->ring, out_cqe);
+    } while (err == -EINTR || err == -EAGAIN || err == -EBUSY);
+    if (err != 0) {
+        printf("io_uring wait failed: %s\n", strerror(-err));
+        uring->is_broken = true;
+        return false;
+    }
+    return true;
+}
+
+static bool uring_read(disc_t* disc, u64 offset, u64 len, u8* out_bytes)
+{
+    uring_t* uring = disc->backend_data;
+    while (len > 0) {
+        if (uring->is_broken) {
+            return pread_read(disc, offset, len, out_bytes);
+        }
+        struct io_uring_sqe* sqe = io_uring_get_sqe(&uring->ring);
+        if (sqe == NULL) {
+            return false;
+        }
+        io_uring_prep_read(sqe, disc->fd, out_bytes, len, offset);
+
+        struct io_uring_cqe* cqe;
+        if (!uring_submit(uring) || !uring_wait(uring, &cqe)) {
+            return false;
+        }
+        i32 n = cqe->res;
+        io_uring_cqe_seen(&uring->ring, cqe);
+        if (n <= 0) {
+            return false;
+        }
+        out_bytes += n;
+        offset += n;
+        len -= n;
+    }
+    return true;
+}
+
+// uring_queue_read queues the rest of a read. Reads are tracked by how
+// many bytes are left, so short reads can be queued again.
+static bool uring_queue_read(disc_t* disc, disc_read_t* read, u64* done_bytes)
+{
+    uring_t* uring = disc->backend_data;
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&uring->ring);
+    if (sqe == NULL) {
+        return false;
+    }
+    u64 done = done_bytes[read->index];
+    io_uring_prep_read(sqe, disc->fd, read->out_bytes + done, read->len - done, read->offset + done);
+    io_uring_sqe_set_data(sqe, read);
+    read->is_in_flight = true;
+    return true;
+}
+
+// uring_read_batch keeps as many reads in flight as the queue allows and
+// calls `done` as each one completes. After a failure it stops queueing
+// but still waits for reads in flight, since they write to the caller's
+// buffers. If the ring breaks, those reads are left marked as in flight
+// and the rest of the batch fails. A broken ring reads with pread.
+static bool uring_read_batch(disc_t* disc, disc_read_t* reads, u32 count, disc_read_done_fn done, void* user)
+{
+    uring_t* uring = disc->backend_data;
+    if (uring->is_broken) {
+        bool success = true;
+        for (u32 i = 0; success && i < count; i++) {
+            success = pread_read(disc, reads[i].offset, reads[i].len, reads[i].out_bytes)
+                && done(&reads[i], user);
+        }
+        return success;
+    }
+
+    // Bytes read so far for each read, indexed by the read's position.
+    u64* done_bytes = calloc(count, sizeof(u64));
+    u32* indices = malloc(count * sizeof(u32));
+    if (done_bytes == NULL || indices == NULL) {
+        free(done_bytes);
+        free(indices);
+        return false;
+    }
+
+    // Reads carry the caller's index, swap in our own while in flight.
+    for (u32 i = 0; i < count; i++) {
+        indices[i] = reads[i].index;
+        reads[i].index = i;
+    }
+
+    bool success = true;
+    u32 next = 0;
+    u32 in_flight = 0;
+    while (true) {
+        while (success && next < count && uring_queue_read(disc, &reads[next], done_bytes)) {
+            next++;
+            in_flight++;
+        }
+        if (in_flight == 0) {
+            break;
+        }
+
+        // Nothing more can be reaped from a broken ring. The reads in
+        // flight stay marked, so the caller keeps their buffers.
+        struct io_uring_cqe* cqe;
+        if (!uring_submit(uring) || !uring_wait(uring, &cqe)) {
+            success = false;
+            break;
+        }
+        disc_read_t* read = io_uring_cqe_get_data(cqe);
+        i32 n = cqe->res;
+        io_uring_cqe_seen(&uring->ring, cqe);
+        read->is_in_flight = false;
+        in_flight--;
+
+        if (!success) {
+            continue;
+        }
+        if (n <= 0) {
+            success = false;
+            continue;
+        }
+
+        done_bytes[read->index] += n;
+        if (done_bytes[read->index] < read->len) {
+            if (uring_queue_read(disc, read, done_bytes)) {
+                in_flight++;
+            } else {
+                success = false;
+            }
+            continue;
+        }
+
+        u32 index = read->index;
+        read->index = indices[index];
+        success = done(read, user);
+        read->index = index;
+    }
+
+    for (u32 i = 0; i < count; i++) {
+        reads[i].index = indices[i];
+    }
+    free(done_bytes);
+    free(indices);
+    return success;
+}
+
+#else
+
+static bool uring_open(disc_t* disc)
+{
+    (void)disc;
+    printf("io_uring backend not available, build with liburing\n");
+    return false;
+}
+
+static void uring_close(disc_t* disc)
+{
+    (void)disc;
+}
+
+static bool uring_read(disc_t* disc, u64 offset, u64 len, u8* out_bytes)
+{
+    (void)disc;
+    (void)offset;
+    (void)len;
+    (void)out_bytes;
+    return false;
+}
+
+#endif
+
+const disc_backend_t disc_backend_uring = {
+    .name = "uring",
+    .open = uring_open,
+    .close = uring_close,
+    .read = uring_read,
+#ifdef HAVE_LIBURING
+    .read_batch = uring_read_batch,
+#endif
+};
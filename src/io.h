@@ -0,0 +1,19 @@
+// This file contains the backends used to read BIN files.
+#pragma once
+
+#include "bin.h"
+#include "defines.h"
+
+extern const disc_backend_t disc_backend_stdio;
+extern const disc_backend_t disc_backend_mmap;
+extern const disc_backend_t disc_backend_pread;
+extern const disc_backend_t disc_backend_uring;
+extern const disc_backend_t disc_backend_memory;
+
+// All backends, terminated by NULL.
+extern const disc_backend_t* const disc_backends[];
+
+// The backend used when none is asked for.
+#define DISC_BACKEND_DEFAULT (&disc_backend_mmap)
+
+const disc_backend_t* disc_backend_find(const char* name);
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bin.h"
+#include "iso.h"
+
+// Offsets into a directory record.
+#define RECORD_LEN 0
+#define RECORD_SECTOR 2
+#define RECORD_SIZE 10
+#define RECORD_FLAGS 25
+#define RECORD_NAME_LEN 32
+#define RECORD_NAME 33
+#define RECORD_FLAG_DIRECTORY 0x02
+
+// Offset of the root directory record in the primary volume descriptor.
+#define PVD_ROOT_RECORD 156
+
+typedef struct {
+    disc_file_t* files;
+    u32 num_files;
+    u32 capacity;
+} index_t;
+
+static u32 read_le32(const u8* bytes)
+{
+    u32 value;
+    memcpy(&value, bytes, sizeof(u32));
+    return value;
+}
+
+static bool index_add(index_t* index, const char* path, u32 sector, u32 len)
+{
+    if (index->num_files == index->capacity) {
+        u32 capacity = index->capacity == 0 ? 256 : index->capacity * 2;
+        disc_file_t* files = realloc(index->files, capacity * sizeof(disc_file_t));
+        if (files == NULL) {
+            return false;
+        }
+        index->files = files;
+        index->capacity = capacity;
+    }
+
+    disc_file_t* file = &index->files[index->num_files++];
+    snprintf(file->path, sizeof(file->path), "%s", path);
+    file->sector = sector;
+    file->len = len;
+    return true;
+}
+
+// read_directory adds every file in a directory to the index, and then
+// the files of each sub directory. `prefix` is the directory's path.
+static bool read_directory(disc_t* disc, index_t* index, const char* prefix, u32 sector, u32 size, i32 depth)
+{
+    if (depth > ISO_MAX_DEPTH) {
+        return false;
+    }
+
+    file_t dir = { 0 };
+    if (!read_file(disc, sector, size, &dir)) {
+        return false;
+    }
+
+    bool success = true;
+    u64 offset = 0;
+    while (success && offset < size) {
+        const u8* record = dir.data + offset;
+        u8 record_len = record[RECORD_LEN];
+
+        // Records don't cross sectors, the rest of a sector is padded.
+        if (record_len == 0) {
+            offset = ((offset / SECTOR_SIZE) + 1) * SECTOR_SIZE;
+            continue;
+        }
+        if (record_len < RECORD_NAME || offset + record_len > size) {
+            break;
+        }
+        offset += record_len;
+
+        // Skip "." and "..".
+        u8 name_len = record[RECORD_NAME_LEN];
+        if (name_len == 1 && record[RECORD_NAME] <= 1) {
+            continue;
+        }
+        if (RECORD_NAME + name_len > record_len) {
+            break;
+        }
+
+        // Names have a version, ie MAP000.GNS;1, which is dropped.
+        char name[DISC_PATH_MAX];
+        snprintf(name, sizeof(name), "%.*s", name_len, &record[RECORD_NAME]);
+        char* version = strchr(name, ';');
+        if (version != NULL) {
+            *version = '\0';
+        }
+
+        // Paths that are too long to be kept are skipped.
+        char path[DISC_PATH_MAX];
+        i32 path_len = prefix[0] == '\0'
+            ? snprintf(path, sizeof(path), "%s", name)
+            : snprintf(path, sizeof(path), "%s/%s", prefix, name);
+        if (path_len >= (i32)sizeof(path)) {
+            continue;
+        }
+
+        u32 entry_sector = read_le32(&record[RECORD_SECTOR]);
+        u32 entry_size = read_le32(&record[RECORD_SIZE]);
+        if (record[RECORD_FLAGS] & RECORD_FLAG_DIRECTORY) {
+            success = read_directory(disc, index, path, entry_sector, entry_size, depth + 1);
+        } else {
+            success = index_add(index, path, entry_sector, entry_size);
+        }
+    }
+
+    file_free(&dir);
+    return success;
+}
+
+static int compare_files(const void* a, const void* b)
+{
+    return strcmp(((const disc_file_t*)a)->path, ((const disc_file_t*)b)->path);
+}
+
+// iso_index walks the whole ISO9660 file system once and keeps every
+// file's path, sector and exact length on the disc, sorted by path.
+bool iso_index(disc_t* disc)
+{
+    file_t pvd = { 0 };
+    if (!read_file(disc, ISO_PVD_SECTOR, SECTOR_SIZE, &pvd)) {
+        return false;
+    }
+    bool is_pvd = pvd.data[0] == 0x01 && memcmp(&pvd.data[1], "CD001", 5) == 0;
+    u32 root_sector = read_le32(&pvd.data[PVD_ROOT_RECORD + RECORD_SECTOR]);
+    u32 root_size = read_le32(&pvd.data[PVD_ROOT_RECORD + RECORD_SIZE]);
+    file_free(&pvd);
+    if (!is_pvd) {
+        return false;
+    }
+
+    index_t index = { 0 };
+    if (!read_directory(disc, &index, "", root_sector, root_size, 0)) {
+        free(index.files);
+        return false;
+    }
+
+    qsort(index.files, index.num_files, sizeof(disc_file_t), compare_files);
+    free(disc->files);
+    disc->files = index.files;
+    disc->num_files = index.num_files;
+    return true;
+}
+
+// iso_find returns the file at `path`, ie "MAP/MAP000.GNS", or NULL.
+const disc_file_t* iso_find(const disc_t* disc, const char* path)
+{
+    disc_file_t key = { 0 };
+    snprintf(key.path, sizeof(key.path), "%s", path);
+    return bsearch(&key, disc->files, disc->num_files, sizeof(disc_file_t), compare_files);
+}
@@ -0,0 +1,11 @@
+// This file contains ways to read the ISO9660 file system of a disc.
+#pragma once
+
+#include "bin.h"
+#include "defines.h"
+
+#define ISO_PVD_SECTOR 16
+#define ISO_MAX_DEPTH 8
+
+bool iso_index(disc_t* disc);
+const disc_file_t* iso_find(const disc_t* disc, const char* path);
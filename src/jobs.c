@@ -0,0 +1,221 @@
+#include <sched.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "jobs.h"
+
+// The pool and queue of the worker running on this thread, if any.
+static _Thread_local jobs_t* current_jobs = NULL;
+static _Thread_local u32 current_queue = 0;
+
+static bool queue_push(job_queue_t* queue, const job_t* job)
+{
+    pthread_mutex_lock(&queue->mutex);
+    bool has_room = queue->bottom - queue->top < JOBS_QUEUE_SIZE;
+    if (has_room) {
+        queue->jobs[queue->bottom % JOBS_QUEUE_SIZE] = *job;
+        queue->bottom++;
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return has_room;
+}
+
+// queue_pop takes the newest job, for the worker that owns the queue.
+static bool queue_pop(job_queue_t* queue, job_t* out_job)
+{
+    pthread_mutex_lock(&queue->mutex);
+    bool has_job = queue->bottom != queue->top;
+    if (has_job) {
+        queue->bottom--;
+        *out_job = queue->jobs[queue->bottom % JOBS_QUEUE_SIZE];
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return has_job;
+}
+
+// queue_steal takes the oldest job, for every other thread.
+static bool queue_steal(job_queue_t* queue, job_t* out_job)
+{
+    pthread_mutex_lock(&queue->mutex);
+    bool has_job = queue->bottom != queue->top;
+    if (has_job) {
+        *out_job = queue->jobs[queue->top % JOBS_QUEUE_SIZE];
+        queue->top++;
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return has_job;
+}
+
+static void run_job(const job_t* job)
+{
+    job->fn(job->data);
+    if (job->counter != NULL) {
+        atomic_fetch_sub_explicit(&job->counter->pending, 1, memory_order_release);
+    }
+}
+
+// find_job takes a job from the current worker's queue, or steals one.
+static bool find_job(jobs_t* jobs, job_t* out_job)
+{
+    u32 start = 0;
+    if (current_jobs == jobs) {
+        if (queue_pop(&jobs->queues[current_queue], out_job)) {
+            atomic_fetch_sub(&jobs->num_queued, 1);
+            return true;
+        }
+        start = current_queue + 1;
+    }
+    for (u32 i = 0; i < jobs->num_workers; i++) {
+        u32 victim = (start + i) % jobs->num_workers;
+        if (queue_steal(&jobs->queues[victim], out_job)) {
+            atomic_fetch_sub(&jobs->num_queued, 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void* worker_thread(void* user)
+{
+    job_worker_t* worker = user;
+    jobs_t* jobs = worker->jobs;
+    current_jobs = jobs;
+    current_queue = worker->index;
+
+    while (true) {
+        job_t job;
+        if (find_job(jobs, &job)) {
+            run_job(&job);
+            continue;
+        }
+
+        pthread_mutex_lock(&jobs->sleep_mutex);
+        while (!jobs->quit && atomic_load(&jobs->num_queued) == 0) {
+            pthread_cond_wait(&jobs->sleep_cond, &jobs->sleep_mutex);
+        }
+        bool quit = jobs->quit;
+        pthread_mutex_unlock(&jobs->sleep_mutex);
+        if (quit) {
+            return NULL;
+        }
+    }
+}
+
+// jobs_default_workers is one worker per CPU, less one for the thread
+// that submits jobs and helps while it waits.
+u32 jobs_default_workers(void)
+{
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_cpus <= 1) {
+        return 0;
+    }
+    if (num_cpus > JOBS_MAX_WORKERS) {
+        return JOBS_MAX_WORKERS;
+    }
+    return (u32)num_cpus - 1;
+}
+
+// jobs_init starts `num_workers` worker threads. With no workers, jobs
+// run on the thread that waits for them.
+bool jobs_init(jobs_t* jobs, u32 num_workers)
+{
+    if (num_workers > JOBS_MAX_WORKERS) {
+        num_workers = JOBS_MAX_WORKERS;
+    }
+
+    jobs->quit = false;
+    atomic_init(&jobs->next_queue, 0);
+    atomic_init(&jobs->num_queued, 0);
+    pthread_mutex_init(&jobs->sleep_mutex, NULL);
+    pthread_cond_init(&jobs->sleep_cond, NULL);
+    for (u32 i = 0; i < num_workers; i++) {
+        job_queue_t* queue = &jobs->queues[i];
+        pthread_mutex_init(&queue->mutex, NULL);
+        queue->top = 0;
+        queue->bottom = 0;
+    }
+
+    // Workers steal from each other, so they all need to know how many
+    // there are before any of them starts.
+    jobs->num_workers = num_workers;
+    for (u32 i = 0; i < num_workers; i++) {
+        job_worker_t* worker = &jobs->workers[i];
+        worker->jobs = jobs;
+        worker->index = i;
+        if (pthread_create(&worker->thread, NULL, worker_thread, worker) != 0) {
+            printf("failed to start job worker %u\n", i);
+            jobs->num_workers = i;
+            jobs_shutdown(jobs);
+            return false;
+        }
+    }
+    return true;
+}
+
+// jobs_shutdown stops the workers once they are idle. Every batch must
+// have been waited on.
+void jobs_shutdown(jobs_t* jobs)
+{
+    pthread_mutex_lock(&jobs->sleep_mutex);
+    jobs->quit = true;
+    pthread_cond_broadcast(&jobs->sleep_cond);
+    pthread_mutex_unlock(&jobs->sleep_mutex);
+
+    for (u32 i = 0; i < jobs->num_workers; i++) {
+        pthread_join(jobs->workers[i].thread, NULL);
+        pthread_mutex_destroy(&jobs->queues[i].mutex);
+    }
+    pthread_cond_destroy(&jobs->sleep_cond);
+    pthread_mutex_destroy(&jobs->sleep_mutex);
+}
+
+// jobs_submit queues a batch of jobs. Each job counts against `counter`,
+// which is then passed to jobs_wait. Jobs that don't fit in a queue run
+// right away.
+void jobs_submit(jobs_t* jobs, const job_t* batch, u32 count, job_counter_t* counter)
+{
+    atomic_fetch_add(&counter->pending, count);
+
+    u32 num_queued = 0;
+    for (u32 i = 0; i < count; i++) {
+        job_t job = batch[i];
+        job.counter = counter;
+
+        bool queued = false;
+        if (jobs->num_workers > 0) {
+            u32 queue = current_queue;
+            if (current_jobs != jobs) {
+                queue = atomic_fetch_add(&jobs->next_queue, 1) % jobs->num_workers;
+            }
+            atomic_fetch_add(&jobs->num_queued, 1);
+            queued = queue_push(&jobs->queues[queue], &job);
+            if (!queued) {
+                atomic_fetch_sub(&jobs->num_queued, 1);
+            }
+        }
+        if (queued) {
+            num_queued++;
+        } else {
+            run_job(&job);
+        }
+    }
+
+    if (num_queued > 0) {
+        pthread_mutex_lock(&jobs->sleep_mutex);
+        pthread_cond_broadcast(&jobs->sleep_cond);
+        pthread_mutex_unlock(&jobs->sleep_mutex);
+    }
+}
+
+// jobs_wait runs jobs until every job counted by `counter` is done.
+void jobs_wait(jobs_t* jobs, job_counter_t* counter)
+{
+    while (atomic_load_explicit(&counter->pending, memory_order_acquire) > 0) {
+        job_t job;
+        if (find_job(jobs, &job)) {
+            run_job(&job);
+        } else {
+            sched_yield();
+        }
+    }
+}
@@ -0,0 +1,66 @@
+// This file contains a small work-stealing job system.
+//
+// Each worker thread has its own queue of jobs. Workers run their own jobs
+// newest first and steal the oldest jobs from the other workers when they
+// run out. Jobs may submit more jobs and wait on them, and a thread that
+// waits runs jobs itself until the ones it waits on are done, so waiting
+// from inside a job never deadlocks.
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "defines.h"
+
+#define JOBS_MAX_WORKERS 64
+#define JOBS_QUEUE_SIZE 256
+
+typedef void (*job_fn)(void* data);
+
+// job_counter_t counts the jobs of a batch that haven't finished yet.
+typedef struct {
+    atomic_uint pending;
+} job_counter_t;
+
+typedef struct {
+    job_fn fn;
+    void* data;
+    job_counter_t* counter;
+} job_t;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    job_t jobs[JOBS_QUEUE_SIZE];
+    u32 top;
+    u32 bottom;
+} job_queue_t;
+
+typedef struct jobs_t jobs_t;
+
+typedef struct {
+    jobs_t* jobs;
+    pthread_t thread;
+    u32 index;
+} job_worker_t;
+
+struct jobs_t {
+    job_worker_t workers[JOBS_MAX_WORKERS];
+    job_queue_t queues[JOBS_MAX_WORKERS];
+    u32 num_workers;
+
+    // Jobs submitted by threads that aren't workers are spread over the
+    // queues starting here.
+    atomic_uint next_queue;
+
+    // Idle workers sleep until jobs are queued.
+    pthread_mutex_t sleep_mutex;
+    pthread_cond_t sleep_cond;
+    atomic_uint num_queued;
+    bool quit;
+};
+
+bool jobs_init(jobs_t* jobs, u32 num_workers);
+void jobs_shutdown(jobs_t* jobs);
+u32 jobs_default_workers(void);
+void jobs_submit(jobs_t* jobs, const job_t* batch, u32 count, job_counter_t* counter);
+void jobs_wait(jobs_t* jobs, job_counter_t* counter);
@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cache.h"
+#include "loader.h"
+#include "mesh.h"
+#include "vcache.h"
+
+// load_map reads a map from the cache, or decodes and optimises it and
+// caches it, so the optimisation is only paid for once.
+static bool load_map(loader_t* loader, i32 map, mesh_t* mesh)
+{
+    mesh_reset(mesh);
+    if (cache_load(loader->cache, map, mesh)) {
+        return true;
+    }
+    if (!read_map(loader->disc, map, &loader->jobs, mesh)) {
+        return false;
+    }
+    // The mesh is left as decoded if this fails, which still draws fine.
+    vcache_optimize(mesh);
+    pack_vertices(mesh);
+    cache_store(loader->cache, map, mesh);
+    return true;
+}
+
+static bool is_wanted(loader_t* loader, i32 map)
+{
+    if (map == loader->requested) {
+        return true;
+    }
+    for (u32 i = 0; i < loader->num_wanted; i++) {
+        if (loader->wanted[i] == map) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static loader_slot_t* find_slot(loader_t* loader, i32 map)
+{
+    for (u32 i = 0; i < LOADER_NUM_SLOTS; i++) {
+        loader_slot_t* slot = &loader->slots[i];
+        if (slot->state != SlotEmpty && slot->map == map) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+// free_slot returns a slot that doesn't hold a wanted map, or NULL.
+static loader_slot_t* free_slot(loader_t* loader)
+{
+    for (u32 i = 0; i < LOADER_NUM_SLOTS; i++) {
+        loader_slot_t* slot = &loader->slots[i];
+        if (slot->state == SlotLoading) {
+            continue;
+        }
+        if (slot->state == SlotEmpty || !is_wanted(loader, slot->map)) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+// next_job picks the requested map, or else the most wanted map, that
+// isn't loaded yet and a slot to load it into. The mutex must be held.
+static loader_slot_t* next_job(loader_t* loader, i32* out_map)
+{
+    if (loader->requested != -1 && find_slot(loader, loader->requested) == NULL) {
+        *out_map = loader->requested;
+        return free_slot(loader);
+    }
+    for (u32 i = 0; i < loader->num_wanted; i++) {
+        if (find_slot(loader, loader->wanted[i]) == NULL) {
+            *out_map = loader->wanted[i];
+            return free_slot(loader);
+        }
+    }
+    return NULL;
+}
+
+static void* loader_thread(void* user)
+{
+    loader_t* loader = user;
+
+    pthread_mutex_lock(&loader->mutex);
+    while (!loader->quit) {
+        i32 map;
+        loader_slot_t* slot = next_job(loader, &map);
+        if (slot == NULL) {
+            pthread_cond_wait(&loader->cond, &loader->mutex);
+            continue;
+        }
+        slot->map = map;
+        slot->state = SlotLoading;
+        pthread_mutex_unlock(&loader->mutex);
+
+        bool success = load_map(loader, map, slot->mesh);
+
+        pthread_mutex_lock(&loader->mutex);
+        slot->state = success ? SlotReady : SlotFailed;
+    }
+    pthread_mutex_unlock(&loader->mutex);
+    return NULL;
+}
+
+// free_slots frees the slots' meshes, as many as were allocated.
+static void free_slots(loader_t* loader)
+{
+    for (u32 i = 0; i < LOADER_NUM_SLOTS && loader->slots[i].mesh != NULL; i++) {
+        mesh_free(loader->slots[i].mesh);
+        free(loader->slots[i].mesh);
+        loader->slots[i].mesh = NULL;
+    }
+}
+
+// loader_init starts the loader thread. From then on the disc and cache
+// belong to it. On failure everything it set up is undone, in reverse.
+bool loader_init(loader_t* loader, disc_t* disc, cache_t* cache)
+{
+    *loader = (loader_t) { .disc = disc, .cache = cache, .requested = -1 };
+    for (u32 i = 0; i < LOADER_NUM_SLOTS; i++) {
+        loader->slots[i].mesh = calloc(1, sizeof(mesh_t));
+        if (loader->slots[i].mesh == NULL) {
+            free_slots(loader);
+            return false;
+        }
+    }
+
+    if (!jobs_init(&loader->jobs, jobs_default_workers())) {
+        free_slots(loader);
+        return false;
+    }
+
+    pthread_mutex_init(&loader->mutex, NULL);
+    pthread_cond_init(&loader->cond, NULL);
+    if (pthread_create(&loader->thread, NULL, loader_thread, loader) != 0) {
+        pthread_cond_destroy(&loader->cond);
+        pthread_mutex_destroy(&loader->mutex);
+        jobs_shutdown(&loader->jobs);
+        free_slots(loader);
+        return false;
+    }
+    return true;
+}
+
+// loader_shutdown waits for the current load to finish and stops the
+// thread.
+void loader_shutdown(loader_t* loader)
+{
+    pthread_mutex_lock(&loader->mutex);
+    loader->quit = true;
+    pthread_cond_signal(&loader->cond);
+    pthread_mutex_unlock(&loader->mutex);
+    pthread_join(loader->thread, NULL);
+
+    pthread_cond_destroy(&loader->cond);
+    pthread_mutex_destroy(&loader->mutex);
+    jobs_shutdown(&loader->jobs);
+    free_slots(loader);
+}
+
+// loader_request asks for a map to be loaded ahead of any prefetching,
+// replacing the previous request. It returns true if the map was already
+// prefetched.
+bool loader_request(loader_t* loader, i32 map)
+{
+    pthread_mutex_lock(&loader->mutex);
+    loader->requested = map;
+    loader_slot_t* slot = find_slot(loader, map);
+    bool is_prefetched = slot != NULL && slot->state == SlotReady;
+    pthread_cond_signal(&loader->cond);
+    pthread_mutex_unlock(&loader->mutex);
+    return is_prefetched;
+}
+
+// loader_prefetch replaces the maps to prefetch, most wanted first. Slots
+// holding maps that are no longer wanted are reused.
+void loader_prefetch(loader_t* loader, const i32* maps, u32 count)
+{
+    pthread_mutex_lock(&loader->mutex);
+    loader->num_wanted = 0;
+    for (u32 i = 0; i < count && i < LOADER_NUM_SLOTS - 1; i++) {
+        loader->wanted[loader->num_wanted++] = maps[i];
+    }
+    pthread_cond_signal(&loader->cond);
+    pthread_mutex_unlock(&loader->mutex);
+}
+
+// loader_poll checks on a map without blocking. When it is ready it is
+// swapped into `inout_mesh`, and the old mesh takes the slot's place as
+// `current_map`, so going back to it is a swap too.
+u32 loader_poll(loader_t* loader, i32 map, i32 current_map, mesh_t** inout_mesh)
+{
+    u32 status = LoadPending;
+
+    pthread_mutex_lock(&loader->mutex);
+    loader_slot_t* slot = find_slot(loader, map);
+    if (slot != NULL && slot->state == SlotReady) {
+        mesh_t* mesh = slot->mesh;
+        slot->mesh = *inout_mesh;
+        slot->map = current_map;
+        slot->state = current_map == -1 ? SlotEmpty : SlotReady;
+        *inout_mesh = mesh;
+        status = LoadReady;
+    } else if (slot != NULL && slot->state == SlotFailed) {
+        slot->state = SlotEmpty;
+        status = LoadFailed;
+    }
+    if (status != LoadPending && loader->requested == map) {
+        loader->requested = -1;
+    }
+    pthread_mutex_unlock(&loader->mutex);
+
+    return status;
+}
@@ -0,0 +1,67 @@
+// This file contains the background map loader.
+//
+// All map loading happens on a loader thread: disc reads, parsing and
+// decoding, with the decoding spread over a job system. The frame thread
+// asks for a map with loader_request and polls for it each frame, so it
+// never blocks on the disc. The thread also
+// decodes maps the user is likely to switch to next into spare mesh_t
+// slots, so switching to one of them is just a pointer swap.
+#pragma once
+
+#include <pthread.h>
+
+#include "bin.h"
+#include "cache.h"
+#include "defines.h"
+#include "jobs.h"
+#include "mesh.h"
+
+// Enough for the requested map and its neighbours two deep.
+#define LOADER_NUM_SLOTS 5
+
+enum SlotState {
+    SlotEmpty,
+    SlotLoading,
+    SlotReady,
+    SlotFailed,
+};
+
+enum LoadStatus {
+    LoadPending,
+    LoadReady,
+    LoadFailed,
+};
+
+typedef struct {
+    i32 map;
+    u32 state;
+    mesh_t* mesh;
+} loader_slot_t;
+
+typedef struct {
+    disc_t* disc;
+    cache_t* cache;
+
+    // Decodes each map's resources in parallel.
+    jobs_t jobs;
+
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool quit;
+
+    loader_slot_t slots[LOADER_NUM_SLOTS];
+
+    // The map the user switched to, loaded before anything else.
+    i32 requested;
+
+    // Maps to prefetch, most wanted first.
+    i32 wanted[LOADER_NUM_SLOTS];
+    u32 num_wanted;
+} loader_t;
+
+bool loader_init(loader_t* loader, disc_t* disc, cache_t* cache);
+void loader_shutdown(loader_t* loader);
+bool loader_request(loader_t* loader, i32 map);
+void loader_prefetch(loader_t* loader, const i32* maps, u32 count);
+u32 loader_poll(loader_t* loader, i32 map, i32 current_map, mesh_t** inout_mesh);
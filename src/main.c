@@ -1,7 +1,10 @@
+#include "cache.h"
 #include "camera.h"
 #include "cube.h"
 #include "defines.h"
+#include "io.h"
 #include "keystate.h"
+#include "loader.h"
 #include "maths.h"
 #include "mesh.h"
 
@@ -21,15 +24,25 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+// The BIN file used when none is given on the command line or in the
+// HERETIC_BIN environment variable.
+#define DEFAULT_BIN_PATH "/home/adam/sync/emu/fft.bin"
+
 // Forward declarations;
 static void init(void);
 static void event(const sapp_event* ev);
 static void frame(void);
 static void cleanup(void);
 static void draw_ui(void);
-static void next_map(void);
-static void prev_map(void);
-static void load_map(i32 map);
+static void next_map(bool held);
+static void prev_map(bool held);
+static void request_map(i32 map);
+static void poll_map(void);
+static void upload_map(void);
+static void upload_variant(void);
+static void upload_live_indices(void);
+static void draw_chunks(const geometry_t* geometry, mat4 model);
+static void prefetch_neighbours(i32 map, i32 direction, bool held);
 
 static struct {
     f32 time;
@@ -37,8 +50,34 @@ static struct {
 
     i32 mapnum;
 
+    const char* bin_path;
+    const disc_backend_t* disc_backend;
+    disc_t disc;
+    cache_t cache;
+
     camera_t cam;
-    mesh_t mesh;
+
+    // The map in `mesh`, and whether it was prefetched. While the loader
+    // works on `loading_map` the loaded map is still drawn.
+    mesh_t* mesh;
+    i32 loaded_map;
+    i32 loading_map;
+    bool is_prefetched;
+    loader_t loader;
+
+    // Every texture of the loaded map, so switching variants only changes
+    // which one is bound.
+    sg_image map_textures[MESH_MAX_TEXTURES];
+
+    // The loaded map's indices, and the live indices it draws geometry 0
+    // and its patches from. `live_geometry` is what the live buffer holds.
+    sg_buffer map_indices;
+    sg_buffer map_live_indices;
+    u32 live_geometry;
+
+    // What draw_chunks drew in the last frame.
+    u32 num_drawn_chunks;
+    u32 num_draws;
 
     vec4 clear_color;
 
@@ -54,8 +93,26 @@ static struct {
 
 sapp_desc sokol_main(i32 argc, char* argv[])
 {
-    (void)argc;
-    (void)argv;
+    // The BIN path comes from the first argument, then HERETIC_BIN.
+    g.bin_path = getenv("HERETIC_BIN");
+    if (argc > 1) {
+        g.bin_path = argv[1];
+    }
+    if (g.bin_path == NULL) {
+        g.bin_path = DEFAULT_BIN_PATH;
+    }
+
+    // The disc backend can be picked with HERETIC_DISC_BACKEND.
+    g.disc_backend = DISC_BACKEND_DEFAULT;
+    const char* backend_name = getenv("HERETIC_DISC_BACKEND");
+    if (backend_name != NULL) {
+        g.disc_backend = disc_backend_find(backend_name);
+        if (g.disc_backend == NULL) {
+            printf("unknown disc backend %s\n", backend_name);
+            exit(1);
+        }
+    }
+
     return (sapp_desc) {
         .init_cb = init,
         .event_cb = event,
@@ -80,7 +137,61 @@ static void init(void)
     g.draw_mode = 0;
     g.mapnum = 49;
 
-    load_map(g.mapnum);
+    if (!disc_open(&g.disc, g.bin_path, g.disc_backend)) {
+        printf("failed to open %s\n", g.bin_path);
+        exit(1);
+    }
+    if (!cache_open(&g.cache, &g.disc)) {
+        printf("map cache disabled\n");
+    }
+
+    g.mesh = calloc(1, sizeof(mesh_t));
+    g.loaded_map = -1;
+    g.loading_map = -1;
+    if (g.mesh == NULL || !loader_init(&g.loader, &g.disc, &g.cache)) {
+        printf("failed to start map loader\n");
+        exit(1);
+    }
+
+    g.basic_shader = sg_make_shader(basic_shader_desc(sg_query_backend()));
+    g.light_shader = sg_make_shader(light_shader_desc(sg_query_backend()));
+
+    g.pipe_object = sg_make_pipeline(&(sg_pipeline_desc) {
+        .shader = g.basic_shader,
+        .index_type = SG_INDEXTYPE_UINT16,
+        .face_winding = SG_FACEWINDING_CW,
+        .cull_mode = SG_CULLMODE_BACK,
+        .layout = {
+            .attrs = {
+                // See packed_vertex_t.
+                [ATTR_vs_basic_a_pos].format = SG_VERTEXFORMAT_SHORT4,
+                [ATTR_vs_basic_a_normal].format = SG_VERTEXFORMAT_SHORT2N,
+                [ATTR_vs_basic_a_uv].format = SG_VERTEXFORMAT_UBYTE4,
+            },
+        },
+        .depth = { .compare = SG_COMPAREFUNC_LESS_EQUAL, .write_enabled = true },
+        .label = "cube-pipeline",
+    });
+
+    g.pipe_light = sg_make_pipeline(&(sg_pipeline_desc) {
+        .shader = g.light_shader,
+        .layout = {
+            .buffers[0].stride = 36,
+            .attrs = {
+                [ATTR_vs_light_aPos].format = SG_VERTEXFORMAT_FLOAT3,
+            },
+        },
+        .depth = { .compare = SG_COMPAREFUNC_LESS_EQUAL, .write_enabled = true },
+        .label = "light-pipeline",
+    });
+
+    g.bind_light.vertex_buffers[0] = sg_make_buffer(&(sg_buffer_desc) {
+        .data = SG_RANGE(cube_vertices),
+        .label = "light-vertices",
+    });
+
+    request_map(g.mapnum);
+    prefetch_neighbours(g.mapnum, 1, false);
 
     g.clear_color = (vec4) { 0.2f, 0.3f, 0.3f, 1.0f };
 }
@@ -92,10 +203,10 @@ static void event(const sapp_event* ev)
             sapp_quit();
         }
         if (ev->key_code == SAPP_KEYCODE_K) {
-            next_map();
+            next_map(ev->key_repeat);
         }
         if (ev->key_code == SAPP_KEYCODE_J) {
-            prev_map();
+            prev_map(ev->key_repeat);
         }
     }
 
@@ -124,6 +235,8 @@ static void frame(void)
 
     g.time += (f32)sapp_frame_duration();
 
+    poll_map();
+
     cam_update(&g.cam, sapp_width(), sapp_height());
 
     draw_ui();
@@ -131,13 +244,24 @@ static void frame(void)
     sg_begin_default_pass(&g.pass_action, sapp_width(), sapp_height());
 
     // Basic object w/ texture
-    {
+    if (g.loaded_map != -1 && g.mesh->num_indices > 0) {
+        const geometry_t* geometry = &g.mesh->geometries[g.mesh->geometry];
+        if (mesh_is_live(g.mesh, g.mesh->geometry)) {
+            upload_live_indices();
+            geometry = &g.mesh->geometries[0];
+            g.bind_object.index_buffer = g.map_live_indices;
+            g.bind_object.index_buffer_offset = 0;
+        } else {
+            g.bind_object.index_buffer = g.map_indices;
+            g.bind_object.index_buffer_offset = (i32)(geometry->first_index * sizeof(u16));
+        }
+        g.bind_object.vertex_buffer_offsets[0] = (i32)(geometry->first_vertex * sizeof(packed_vertex_t));
         sg_apply_pipeline(g.pipe_object);
         sg_apply_bindings(&g.bind_object);
 
         // Vertex
         mat4 model = mat4_identity();
-        model = mat4_mul(model, mat4_translation(g.mesh.center_transform));
+        model = mat4_mul(model, mat4_translation(g.mesh->center_transform));
         vs_basic_params_t vs_params = {
             .u_projection = g.cam.proj,
             .u_view = g.cam.view,
@@ -148,22 +272,22 @@ static void frame(void)
         // Fragment
         fs_basic_params_t fs_params = {
             .u_draw_mode = g.draw_mode,
-            .u_ambient_color = g.mesh.ambient_light_color,
+            .u_ambient_color = g.mesh->ambient_light_color,
         };
         sg_apply_uniforms(SG_SHADERSTAGE_FS, SLOT_fs_basic_params, &SG_RANGE(fs_params));
 
         fs_dir_lights_t fs_lights = { 0 };
         for (i32 i = 0; i < 3; i++) {
-            fs_lights.color[i] = vec3_to_vec4(g.mesh.dir_lights[i].color);
-            fs_lights.position[i] = vec3_to_vec4(g.mesh.dir_lights[i].position);
+            fs_lights.color[i] = vec3_to_vec4(g.mesh->dir_lights[i].color);
+            fs_lights.position[i] = vec3_to_vec4(g.mesh->dir_lights[i].position);
         }
         sg_apply_uniforms(SG_SHADERSTAGE_FS, SLOT_fs_dir_lights, &SG_RANGE(fs_lights));
 
-        sg_draw(0, g.mesh.num_vertices, 1);
+        draw_chunks(geometry, model);
     }
 
     // Light cube
-    {
+    if (g.loaded_map != -1) {
         sg_apply_pipeline(g.pipe_light);
         sg_apply_bindings(&g.bind_light);
 
@@ -178,12 +302,12 @@ static void frame(void)
             // This makes the light cubes appear closer, but doesn't
             // affect the lighting calculations the the other fragment
             // shader. Its just nice to see the lights.
-            vec3 closer_position = vec3_divf(g.mesh.dir_lights[i].position, 7.0f);
+            vec3 closer_position = vec3_divf(g.mesh->dir_lights[i].position, 7.0f);
             model = mat4_mul(model, mat4_translation(closer_position));
             vs_params.model = model;
             sg_apply_uniforms(SG_SHADERSTAGE_VS, SLOT_vs_light_params, &SG_RANGE(vs_params));
 
-            fs_light_params_t fs_params = { .u_light_color = g.mesh.dir_lights[i].color };
+            fs_light_params_t fs_params = { .u_light_color = g.mesh->dir_lights[i].color };
             sg_apply_uniforms(SG_SHADERSTAGE_FS, SLOT_fs_light_params, &SG_RANGE(fs_params));
 
             sg_draw(0, 36, 1);
@@ -195,76 +319,102 @@ static void frame(void)
     sg_commit();
 }
 
-static void load_map(i32 map)
+// request_map asks the loader for a map. It is uploaded by poll_map once
+// it's ready, until then the current map stays on screen.
+static void request_map(i32 map)
 {
-    g.mesh = (mesh_t) { 0 };
+    g.loading_map = map;
+    g.is_prefetched = loader_request(&g.loader, map);
+}
 
-    if (!read_map(map, &g.mesh)) {
-        printf("failed to open map file\n");
-        exit(1);
+// poll_map checks on the requested map without blocking the frame.
+static void poll_map(void)
+{
+    if (g.loading_map == -1) {
+        return;
     }
 
-    sg_destroy_shader(g.basic_shader);
-    sg_destroy_shader(g.light_shader);
-
-    g.basic_shader = sg_make_shader(basic_shader_desc(sg_query_backend()));
-    g.light_shader = sg_make_shader(light_shader_desc(sg_query_backend()));
+    u32 status = loader_poll(&g.loader, g.loading_map, g.loaded_map, &g.mesh);
+    if (status == LoadPending) {
+        return;
+    }
+    if (status == LoadFailed) {
+        printf("failed to load map %d\n", g.loading_map);
+        g.loading_map = -1;
+        if (g.loaded_map != -1) {
+            g.mapnum = g.loaded_map;
+        }
+        return;
+    }
 
-    sg_destroy_pipeline(g.pipe_object);
-    g.pipe_object = sg_make_pipeline(&(sg_pipeline_desc) {
-        .shader = g.basic_shader,
-        .face_winding = SG_FACEWINDING_CW,
-        .cull_mode = SG_CULLMODE_BACK,
-        .layout = {
-            .attrs = {
-                [ATTR_vs_basic_a_pos].format = SG_VERTEXFORMAT_FLOAT3,
-                [ATTR_vs_basic_a_normal].format = SG_VERTEXFORMAT_FLOAT3,
-                [ATTR_vs_basic_a_uv].format = SG_VERTEXFORMAT_FLOAT2,
-                [ATTR_vs_basic_a_palette].format = SG_VERTEXFORMAT_FLOAT,
-            },
-        },
-        .depth = { .compare = SG_COMPAREFUNC_LESS_EQUAL, .write_enabled = true },
-        .label = "cube-pipeline",
-    });
+    g.loaded_map = g.loading_map;
+    g.loading_map = -1;
+    upload_map();
+}
 
-    sg_destroy_pipeline(g.pipe_light);
-    g.pipe_light = sg_make_pipeline(&(sg_pipeline_desc) {
-        .shader = g.light_shader,
-        .layout = {
-            .buffers[0].stride = 36,
-            .attrs = {
-                [ATTR_vs_light_aPos].format = SG_VERTEXFORMAT_FLOAT3,
-            },
-        },
-        .depth = { .compare = SG_COMPAREFUNC_LESS_EQUAL, .write_enabled = true },
-        .label = "light-pipeline",
-    });
+// upload_map replaces the GPU resources with the ones for `g.mesh`.
+static void upload_map(void)
+{
+    // sokol doesn't take empty buffers, so a map without polygons has
+    // none and isn't drawn.
+    sg_destroy_buffer(g.bind_object.vertex_buffers[0]);
+    sg_destroy_buffer(g.map_indices);
+    g.bind_object.vertex_buffers[0] = (sg_buffer) { SG_INVALID_ID };
+    g.map_indices = (sg_buffer) { SG_INVALID_ID };
+    if (g.mesh->num_indices > 0) {
+        g.bind_object.vertex_buffers[0] = sg_make_buffer(&(sg_buffer_desc) {
+            .data = { g.mesh->packed_vertices, g.mesh->num_vertices * sizeof(packed_vertex_t) },
+            .label = "map-vertices",
+        });
+        g.map_indices = sg_make_buffer(&(sg_buffer_desc) {
+            .type = SG_BUFFERTYPE_INDEXBUFFER,
+            .data = { g.mesh->indices, g.mesh->num_indices * sizeof(u16) },
+            .label = "map-indices",
+        });
+    }
 
-    sg_destroy_buffer(g.bind_light.vertex_buffers[0]);
-    g.bind_light.vertex_buffers[0] = sg_make_buffer(&(sg_buffer_desc) {
-        .data = SG_RANGE(cube_vertices),
-        .label = "light-vertices",
+    // Filled in when it is first drawn, by upload_live_indices.
+    sg_destroy_buffer(g.map_live_indices);
+    g.map_live_indices = sg_make_buffer(&(sg_buffer_desc) {
+        .type = SG_BUFFERTYPE_INDEXBUFFER,
+        .usage = SG_USAGE_DYNAMIC,
+        .size = (g.mesh->geometries[0].num_indices + 1) * sizeof(u16),
+        .label = "map-live-indices",
     });
+    g.live_geometry = MESH_NO_GEOMETRY;
+    g.num_drawn_chunks = 0;
+    g.num_draws = 0;
 
-    sg_destroy_buffer(g.bind_object.vertex_buffers[0]);
-    g.bind_object.vertex_buffers[0] = sg_make_buffer(&(sg_buffer_desc) {
-        .data = SG_RANGE(g.mesh.vertices),
-        .label = "map-vertices",
-    });
+    // Maps are drawn centered, so the camera frames the centered sphere.
+    sphere_t sphere = g.mesh->bounding_sphere;
+    cam_frame(&g.cam, vec3_add(sphere.center, g.mesh->center_transform), sphere.radius);
 
-    sg_destroy_image(g.bind_object.fs_images[SLOT_u_tex]);
-    g.bind_object.fs_images[SLOT_u_tex] = sg_alloc_image();
-    sg_init_image(g.bind_object.fs_images[SLOT_u_tex],
-        &(sg_image_desc) {
-            .pixel_format = SG_PIXELFORMAT_RGBA8,
-            .width = TEXTURE_WIDTH,
+    for (u32 i = 0; i < MESH_MAX_TEXTURES; i++) {
+        sg_destroy_image(g.map_textures[i]);
+        g.map_textures[i] = (sg_image) { SG_INVALID_ID };
+    }
+    for (u32 i = 0; i < g.mesh->num_textures; i++) {
+        g.map_textures[i] = sg_make_image(&(sg_image_desc) {
+            .pixel_format = SG_PIXELFORMAT_R8,
+            .width = TEXTURE_PACKED_WIDTH,
             .height = TEXTURE_HEIGHT,
             .data.subimage[0][0] = {
-                .ptr = g.mesh.texture,
+                .ptr = &g.mesh->textures[i * TEXTURE_NUM_BYTES],
                 .size = (size_t)(TEXTURE_NUM_BYTES),
             },
             .label = "map-texture",
         });
+    }
+
+    upload_variant();
+}
+
+// upload_variant binds the texture of the variant `g.mesh` shows and
+// uploads its palette. The rest of a variant is uniforms, a range of the
+// map's buffers or patches of the live indices.
+static void upload_variant(void)
+{
+    g.bind_object.fs_images[SLOT_u_tex] = g.map_textures[g.mesh->variants[g.mesh->variant].texture];
 
     sg_destroy_image(g.bind_object.fs_images[SLOT_u_palette]);
     g.bind_object.fs_images[SLOT_u_palette] = sg_alloc_image();
@@ -274,29 +424,98 @@ static void load_map(i32 map)
             .width = 16 * 16,
             .height = 1,
             .data.subimage[0][0] = {
-                .ptr = g.mesh.palette,
+                .ptr = g.mesh->palette,
                 .size = (size_t)(PALETTE_NUM_BYTES),
             },
             .label = "palette-texture",
         });
 }
 
-static void next_map(void)
+// upload_live_indices uploads the live indices if a variant with other
+// patches was shown since they were last uploaded. sokol can only update
+// a buffer from the start, so all of geometry 0's indices are uploaded,
+// but that is a few KiB and nothing is decoded.
+static void upload_live_indices(void)
 {
-    g.mapnum++;
-    if (g.mapnum > 119) {
-        g.mapnum = 1;
+    u32 num_indices = g.mesh->geometries[0].num_indices;
+    if (g.live_geometry == g.mesh->live_geometry || num_indices == 0) {
+        return;
     }
-    load_map(g.mapnum);
+    sg_update_buffer(g.map_live_indices, &(sg_range) { g.mesh->live_indices, num_indices * sizeof(u16) });
+    g.live_geometry = g.mesh->live_geometry;
 }
 
-static void prev_map(void)
+// draw_chunks draws the chunks of a geometry that are in view. Chunks
+// next to each other in the index buffer are drawn together.
+static void draw_chunks(const geometry_t* geometry, mat4 model)
 {
-    g.mapnum--;
-    if (g.mapnum < 1) {
-        g.mapnum = 119;
+    frustum_t frustum = frustum_from_matrix(mat4_mul(mat4_mul(model, g.cam.view), g.cam.proj));
+    g.num_drawn_chunks = 0;
+    g.num_draws = 0;
+
+    u32 first_index = 0;
+    u32 num_indices = 0;
+    for (u32 i = 0; i < geometry->num_chunks; i++) {
+        const chunk_t* chunk = &g.mesh->chunks[geometry->first_chunk + i];
+        if (!frustum_has_aabb(&frustum, chunk->bounds)) {
+            continue;
+        }
+        g.num_drawn_chunks++;
+        if (num_indices > 0 && first_index + num_indices == chunk->first_index) {
+            num_indices += chunk->num_indices;
+            continue;
+        }
+        if (num_indices > 0) {
+            sg_draw((i32)first_index, (i32)num_indices, 1);
+            g.num_draws++;
+        }
+        first_index = chunk->first_index;
+        num_indices = chunk->num_indices;
+    }
+    if (num_indices > 0) {
+        sg_draw((i32)first_index, (i32)num_indices, 1);
+        g.num_draws++;
+    }
+}
+
+static i32 wrap_map(i32 map)
+{
+    if (map > 119) {
+        return map - 119;
+    }
+    if (map < 1) {
+        return map + 119;
     }
-    load_map(g.mapnum);
+    return map;
+}
+
+// prefetch_neighbours loads the maps around `map` in the background,
+// the next one in `direction` first. While the key is held the one after
+// that is loaded as well.
+static void prefetch_neighbours(i32 map, i32 direction, bool held)
+{
+    i32 maps[3];
+    u32 count = 0;
+    maps[count++] = wrap_map(map + direction);
+    if (held) {
+        maps[count++] = wrap_map(map + (direction * 2));
+    }
+    maps[count++] = wrap_map(map - direction);
+    loader_prefetch(&g.loader, maps, count);
+}
+
+static void next_map(bool held)
+{
+    g.mapnum = wrap_map(g.mapnum + 1);
+    request_map(g.mapnum);
+    prefetch_neighbours(g.mapnum, 1, held);
+}
+
+static void prev_map(bool held)
+{
+    g.mapnum = wrap_map(g.mapnum - 1);
+    request_map(g.mapnum);
+    prefetch_neighbours(g.mapnum, -1, held);
 }
 
 static void draw_ui(void)
@@ -307,6 +526,12 @@ static void draw_ui(void)
     char map_title[10];
     sprintf(map_title, "Map %d", g.mapnum);
     igText(map_title);
+    igSameLine(0, 10);
+    if (g.loading_map != -1) {
+        igTextDisabled("(loading...)");
+    } else {
+        igTextDisabled(g.is_prefetched ? "(prefetched)" : "(cold load)");
+    }
 
     if (!igCollapsingHeader_TreeNodeFlags("Scene", 0)) {
         igRadioButton_IntPtr("Orthographic", (i32*)&g.cam.proj_type, 1);
@@ -318,6 +543,10 @@ static void draw_ui(void)
         igSameLine(200, 10);
         igRadioButton_IntPtr("Color", &g.draw_mode, 2);
         igColorEdit4("Background", (f32*)&g.clear_color, ImGuiColorEditFlags_None);
+        if (g.loaded_map != -1) {
+            const geometry_t* geometry = &g.mesh->geometries[mesh_is_live(g.mesh, g.mesh->geometry) ? 0 : g.mesh->geometry];
+            igText("Chunks: %u of %u, in %u draws", g.num_drawn_chunks, geometry->num_chunks, g.num_draws);
+        }
         igText("");
     }
     if (!igCollapsingHeader_TreeNodeFlags("Camera", 0)) {
@@ -327,16 +556,30 @@ static void draw_ui(void)
         igText("");
     }
 
+    if (g.loaded_map != -1 && g.mesh->num_variants > 1 && !igCollapsingHeader_TreeNodeFlags("Variants", 0)) {
+        for (u32 i = 0; i < g.mesh->num_variants; i++) {
+            const map_state_t* state = &g.mesh->variants[i].state;
+            char label[64];
+            snprintf(label, sizeof(label), "Arrangement %d, %s, weather %d",
+                state->arrangement, state->time == TimeNight ? "night" : "day", state->weather);
+            if (igRadioButton_Bool(label, g.mesh->variant == i) && g.mesh->variant != i) {
+                mesh_set_variant(g.mesh, i);
+                upload_variant();
+            }
+        }
+        igText("");
+    }
+
     if (!igCollapsingHeader_TreeNodeFlags("Lights", 0)) {
         igSeparatorText("Ambient");
-        igColorEdit3("Color", (f32*)&g.mesh.ambient_light_color, ImGuiColorEditFlags_None);
+        igColorEdit3("Color", (f32*)&g.mesh->ambient_light_color, ImGuiColorEditFlags_None);
         for (i32 i = 0; i < 3; i++) {
             igPushID_Int(i);
             char title[10];
             sprintf(title, "Light %d", i);
             igSeparatorText(title);
-            igSliderFloat3("Position", (f32*)&g.mesh.dir_lights[i].position, -50.0f, 50.0f, "%0.2f", 0);
-            igColorEdit3("Color", (f32*)&g.mesh.dir_lights[i].color, ImGuiColorEditFlags_None);
+            igSliderFloat3("Position", (f32*)&g.mesh->dir_lights[i].position, -50.0f, 50.0f, "%0.2f", 0);
+            igColorEdit3("Color", (f32*)&g.mesh->dir_lights[i].color, ImGuiColorEditFlags_None);
             igPopID();
         }
         igText("");
@@ -346,6 +589,10 @@ static void draw_ui(void)
 
 static void cleanup(void)
 {
+    loader_shutdown(&g.loader);
+    mesh_free(g.mesh);
+    free(g.mesh);
+    disc_close(&g.disc);
     simgui_shutdown();
     sg_shutdown();
 }
@@ -187,6 +187,86 @@ inline mat4 mat4_scale(vec3 scale)
     return result;
 }
 
+//
+// Bounds
+//
+
+inline aabb_t aabb_empty(void)
+{
+    return (aabb_t) {
+        .min = { INFINITY, INFINITY, INFINITY },
+        .max = { -INFINITY, -INFINITY, -INFINITY },
+    };
+}
+
+inline bool aabb_is_empty(aabb_t box)
+{
+    return box.min.x > box.max.x || box.min.y > box.max.y || box.min.z > box.max.z;
+}
+
+inline aabb_t aabb_merge(aabb_t a, aabb_t b)
+{
+    return (aabb_t) {
+        .min = { fminf(a.min.x, b.min.x), fminf(a.min.y, b.min.y), fminf(a.min.z, b.min.z) },
+        .max = { fmaxf(a.max.x, b.max.x), fmaxf(a.max.y, b.max.y), fmaxf(a.max.z, b.max.z) },
+    };
+}
+
+inline vec3 aabb_center(aabb_t box)
+{
+    return (vec3) {
+        (box.min.x + box.max.x) / 2.0f,
+        (box.min.y + box.max.y) / 2.0f,
+        (box.min.z + box.max.z) / 2.0f,
+    };
+}
+
+// aabb_sphere returns the sphere through the corners of a box. An empty
+// box gives an empty sphere at the origin.
+inline sphere_t aabb_sphere(aabb_t box)
+{
+    if (aabb_is_empty(box)) {
+        return (sphere_t) { 0 };
+    }
+    vec3 half = {
+        (box.max.x - box.min.x) / 2.0f,
+        (box.max.y - box.min.y) / 2.0f,
+        (box.max.z - box.min.z) / 2.0f,
+    };
+    return (sphere_t) { .center = aabb_center(box), .radius = vec3_length(half) };
+}
+
+// frustum_from_matrix returns the planes of a view from the matrix that
+// takes points to clip space, in the order the shaders multiply them.
+// Points are in view when -w <= x, y, z <= w.
+inline frustum_t frustum_from_matrix(mat4 m)
+{
+    const f32* d = m.data;
+    frustum_t frustum;
+    for (i32 i = 0; i < 3; i++) {
+        frustum.planes[i * 2] = (vec4) { d[3] + d[i], d[7] + d[4 + i], d[11] + d[8 + i], d[15] + d[12 + i] };
+        frustum.planes[i * 2 + 1] = (vec4) { d[3] - d[i], d[7] - d[4 + i], d[11] - d[8 + i], d[15] - d[12 + i] };
+    }
+    return frustum;
+}
+
+// frustum_has_aabb returns whether any of a box might be in view. Boxes
+// near a corner of the view can be let through when they aren't in it.
+inline bool frustum_has_aabb(const frustum_t* frustum, aabb_t box)
+{
+    for (i32 i = 0; i < 6; i++) {
+        vec4 p = frustum->planes[i];
+        // The corner furthest inside the plane.
+        f32 x = p.x > 0.0f ? box.max.x : box.min.x;
+        f32 y = p.y > 0.0f ? box.max.y : box.min.y;
+        f32 z = p.z > 0.0f ? box.max.z : box.min.z;
+        if (p.x * x + p.y * y + p.z * z + p.w < 0.0f) {
+            return false;
+        }
+    }
+    return true;
+}
+
 //
 // Utilities
 //
@@ -18,6 +18,23 @@ typedef struct {
     f32 data[16];
 } mat4;
 
+// aabb_t is an axis aligned bounding box. An empty box has min above max.
+typedef struct {
+    vec3 min;
+    vec3 max;
+} aabb_t;
+
+typedef struct {
+    vec3 center;
+    f32 radius;
+} sphere_t;
+
+// frustum_t is the planes of a view, each as (a, b, c, d) with the inside
+// where ax + by + cz + d >= 0.
+typedef struct {
+    vec4 planes[6];
+} frustum_t;
+
 vec3 vec3_add(vec3 a, vec3 b);
 vec3 vec3_mulf(vec3 v, f32 f);
 vec3 vec3_divf(vec3 a, f32 f);
@@ -28,6 +45,14 @@ f32 vec3_dot(vec3 a, vec3 b);
 f32 vec3_length(vec3 v);
 vec4 vec3_to_vec4(vec3 v);
 
+aabb_t aabb_empty(void);
+bool aabb_is_empty(aabb_t box);
+aabb_t aabb_merge(aabb_t a, aabb_t b);
+vec3 aabb_center(aabb_t box);
+sphere_t aabb_sphere(aabb_t box);
+frustum_t frustum_from_matrix(mat4 m);
+bool frustum_has_aabb(const frustum_t* frustum, aabb_t box);
+
 mat4 mat4_identity(void);
 mat4 mat4_mul(mat4 a, mat4 b);
 mat4 mat4_look_at(vec3 position, vec3 target, vec3 up);
@@ -1,81 +1,896 @@
 #include <assert.h>
 #include <float.h>
 #include <math.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
 
 #include "bin.h"
-#include "gns.h"
+#include "decode.h"
+#include "iso.h"
+#include "jobs.h"
 #include "maths.h"
 #include "mesh.h"
 
+// Polygons and texture bytes decoded by a single job.
+#define MESH_JOB_POLYGONS 128
+
+// Slots in the hash table used to weld vertices. A power of two, over
+// twice MAX_INDICES.
+#define WELD_TABLE_SIZE 16384
+
+// The kinds of polygons in a mesh, in the order they are stored.
+enum PolygonKind {
+    PolygonTexturedTriangle, // N
+    PolygonTexturedQuad,     // P
+    PolygonTriangle,         // Q
+    PolygonQuad,             // R
+    PolygonKindCount,
+};
+
+// Most sections a mesh record can be split into.
+#define MESH_MAX_SECTIONS ((512 + 768 + 64 + 256) / MESH_JOB_POLYGONS + PolygonKindCount)
+
+STATIC_ASSERT(MESH_MAX_SECTIONS * MESH_MAX_GEOMETRIES <= MESH_MAX_PATCHES, "Expected a patch for every section of every geometry.");
+
+// mesh_record_t is what a GNS mesh record holds. Records other than the
+// primary can leave out any of the polygons, palette and lights.
+typedef struct {
+    bool has_polygons;
+    bool has_palette;
+    bool has_lights;
+
+    // The number of polygons of each kind.
+    u16 counts[PolygonKindCount];
+
+    // Welded polygons, allocated when they are decoded. A record decoded
+    // against another only has the polygons that differ from it, and
+    // patches of the other's indices to swap them in.
+    bool is_decoded;
+    bool is_delta;
+    vertex_t* vertices;
+    u32 num_vertices;
+    u16* indices;
+    u32 num_indices;
+    patch_t patches[MESH_MAX_SECTIONS];
+    u32 num_patches;
+
+    // Bounds of all of the record's polygons, and of each section, found
+    // as they are decoded. A record decoded against another takes the
+    // bounds of the sections it doesn't change from it.
+    aabb_t bounds;
+    aabb_t section_bounds[MESH_MAX_SECTIONS];
+
+    // Only the palette, lights and background are read.
+    variant_t variant;
+} mesh_record_t;
+
+typedef struct resources resources_t;
+
+// resource_t is a GNS record that is decoded. With a job system, its file
+// is kept here until its decode job is done. Mesh records are kept until
+// the whole map is decoded, as others are compared against them.
+typedef struct {
+    resources_t* resources;
+    u32 index;
+    file_t file;
+} resource_t;
+
+// resources_t is the state shared by the resources of a GNS file while
+// they are read.
+struct resources {
+    const record_t* records;
+    mesh_t* mesh;
+
+    // Where each texture record goes in the mesh's textures, -1 if no
+    // variant uses it, and what each mesh record holds. Other mesh records
+    // are decoded against the default state's polygons, `base`.
+    i32 texture_slots[RECORD_MAX_NUM];
+    mesh_record_t* mesh_records;
+    i32 base;
+
+    jobs_t* jobs;
+    job_counter_t counter;
+    resource_t resources[RECORD_MAX_NUM];
+    atomic_bool failed;
+};
+
+// polygon_kind_t describes how a kind of polygon is stored. Quads are
+// split into 2 triangles, a,b,c and b,d,c.
+typedef struct {
+    u32 num_corners;
+    u32 num_vertices;
+    bool is_textured;
+    u32 uv_size;
+    u8 corners[6];
+} polygon_kind_t;
+
+static const polygon_kind_t polygon_kinds[PolygonKindCount] = {
+    [PolygonTexturedTriangle] = { 3, 3, true, 10, { 0, 1, 2 } },
+    [PolygonTexturedQuad] = { 4, 6, true, 12, { 0, 1, 2, 1, 3, 2 } },
+    [PolygonTriangle] = { 3, 3, false, 0, { 0, 1, 2 } },
+    [PolygonQuad] = { 4, 6, false, 0, { 0, 1, 2, 1, 3, 2 } },
+};
+
+// Offset of each corner's u,v in a textured polygon's UV data.
+static const u8 uv_offsets[4] = { 0, 4, 8, 10 };
+
+// mesh_section_t is a run of polygons of the same kind. Sections don't
+// share any input or output so each one can be decoded on its own.
+typedef struct {
+    const file_t* f;
+    vertex_t* vertices;
+    u32 kind;
+    u32 first_vertex;
+    u32 num_polygons;
+
+    // Offsets of the section's data in the file. Untextured polygons have
+    // no normals or UVs.
+    u32 positions;
+    u32 normals;
+    u32 uvs;
+
+    // Bounds of the section's positions, set when it is decoded.
+    aabb_t bounds;
+} mesh_section_t;
+
 // forward declarations
+static bool read_resource(u32 index, file_t* f, void* user);
+static bool read_mesh_header(file_t* f, mesh_record_t* record);
+static bool decode_mesh(const file_t* f, mesh_record_t* record, jobs_t* jobs);
+static bool decode_changes(const file_t* f, mesh_record_t* record, const file_t* base_f, const mesh_record_t* base);
+static bool read_parts(file_t* f, mesh_record_t* record);
 static vec2 process_tex_coords(f32 u, f32 v, u8 page);
-static vec3 mesh_center_transform(mesh_t* mesh);
+static vec3 mesh_center_transform(aabb_t bounds);
 
-bool read_map(int map, mesh_t* mesh)
+// mesh_alloc lays out a mesh's packed vertices and indices in its arena,
+// and the live indices for geometry 0. The arena's memory is reused when
+// it is big enough.
+bool mesh_alloc(mesh_t* mesh, u32 num_vertices, u32 num_indices, u32 num_live_indices)
 {
-    char* filename = "/home/adam/sync/emu/fft.bin";
-    FILE* f = fopen(filename, "r");
-    if (f == NULL) {
-        printf("failed to open %s\n", filename);
+    u64 packed_vertices_size = (u64)num_vertices * sizeof(packed_vertex_t);
+    u64 indices_size = (u64)num_indices * sizeof(u16);
+    u64 live_indices_size = (u64)num_live_indices * sizeof(u16);
+    u64 size = arena_aligned(packed_vertices_size) + arena_aligned(indices_size) + arena_aligned(live_indices_size);
+    if (!arena_reserve(&mesh->arena, size)) {
         return false;
     }
 
-    int sector = gns_sectors[map];
+    mesh->packed_vertices = arena_alloc(&mesh->arena, packed_vertices_size);
+    mesh->indices = arena_alloc(&mesh->arena, indices_size);
+    mesh->live_indices = arena_alloc(&mesh->arena, live_indices_size);
+    mesh->live_geometry = MESH_NO_GEOMETRY;
+    return true;
+}
+
+// Ids of textures, unique across every mesh.
+static atomic_uint_fast64_t next_texture_id = 1;
+
+// mesh_alloc_textures makes room for a mesh's textures. The memory is
+// kept for the next map and only grows. Each call is for new textures,
+// so they also get new ids.
+bool mesh_alloc_textures(mesh_t* mesh, u32 num_textures)
+{
+    if (num_textures > mesh->max_textures) {
+        u8* textures = realloc(mesh->texture_memory, (u64)num_textures * TEXTURE_NUM_BYTES);
+        if (textures == NULL) {
+            return false;
+        }
+        mesh->texture_memory = textures;
+        mesh->max_textures = num_textures;
+    }
+    mesh->textures = mesh->texture_memory;
+    mesh->num_textures = num_textures;
+    mesh->first_texture_id = atomic_fetch_add(&next_texture_id, num_textures);
+    return true;
+}
+
+// mesh_use_textures points a mesh's textures at memory it doesn't own,
+// such as a mapped cache file. They still get new ids.
+void mesh_use_textures(mesh_t* mesh, u8* textures, u32 num_textures)
+{
+    mesh->textures = textures;
+    mesh->num_textures = num_textures;
+    mesh->first_texture_id = atomic_fetch_add(&next_texture_id, num_textures);
+}
+
+// mesh_reset empties a mesh for the next map, keeping its memory. Decoded
+// vertices that were never packed are freed, and a cache file it was
+// loaded from is unmapped.
+void mesh_reset(mesh_t* mesh)
+{
+    free(mesh->vertices);
+    if (mesh->mapping != NULL) {
+        munmap(mesh->mapping, mesh->mapping_size);
+    }
+    arena_t arena = mesh->arena;
+    u8* texture_memory = mesh->texture_memory;
+    u32 max_textures = mesh->max_textures;
+    *mesh = (mesh_t) { .arena = arena, .texture_memory = texture_memory, .max_textures = max_textures };
+    arena_reset(&mesh->arena);
+}
+
+void mesh_free(mesh_t* mesh)
+{
+    mesh_reset(mesh);
+    arena_free(&mesh->arena);
+    free(mesh->texture_memory);
+    *mesh = (mesh_t) { 0 };
+}
+
+// mesh_is_live returns whether a geometry is drawn from the live indices.
+bool mesh_is_live(const mesh_t* mesh, u32 geometry)
+{
+    return geometry == 0 || mesh->geometries[geometry].num_patches > 0;
+}
+
+// patch_live_indices applies the patches of `geometry` to the live
+// indices. Only the ranges patched by it or by the geometry that was
+// applied before are copied.
+static void patch_live_indices(mesh_t* mesh, u32 geometry)
+{
+    const geometry_t* base = &mesh->geometries[0];
+    const u16* base_indices = &mesh->indices[base->first_index];
+    if (mesh->live_geometry == MESH_NO_GEOMETRY) {
+        memcpy(mesh->live_indices, base_indices, base->num_indices * sizeof(u16));
+        mesh->live_geometry = 0;
+    }
+    if (!mesh_is_live(mesh, geometry) || geometry == mesh->live_geometry) {
+        return;
+    }
+
+    const geometry_t* applied = &mesh->geometries[mesh->live_geometry];
+    for (u32 i = 0; i < applied->num_patches; i++) {
+        const patch_t* patch = &mesh->patches[applied->first_patch + i];
+        memcpy(&mesh->live_indices[patch->first_index], &base_indices[patch->first_index], patch->num_indices * sizeof(u16));
+    }
+
+    // A patch's indices are relative to its own geometry's vertices, and
+    // live indices to geometry 0's.
+    const geometry_t* next = &mesh->geometries[geometry];
+    u16 offset = (u16)(next->first_vertex - base->first_vertex);
+    for (u32 i = 0; i < next->num_patches; i++) {
+        const patch_t* patch = &mesh->patches[next->first_patch + i];
+        for (u32 j = 0; j < patch->num_indices; j++) {
+            mesh->live_indices[patch->first_index + j] = mesh->indices[patch->source + j] + offset;
+        }
+    }
+    mesh->live_geometry = geometry;
+}
+
+// mesh_set_variant shows the map in one of its states.
+void mesh_set_variant(mesh_t* mesh, u32 variant)
+{
+    const variant_t* v = &mesh->variants[variant];
+    mesh->variant = variant;
+    mesh->geometry = v->geometry;
+    mesh->bounds = mesh->geometries[v->geometry].bounds;
+    mesh->bounding_sphere = aabb_sphere(mesh->bounds);
+    patch_live_indices(mesh, v->geometry);
+    mesh->texture = &mesh->textures[(u64)v->texture * TEXTURE_NUM_BYTES];
+    mesh->texture_id = mesh->first_texture_id + v->texture;
+    memcpy(mesh->palette, v->palette, sizeof(mesh->palette));
+    memcpy(mesh->dir_lights, v->dir_lights, sizeof(mesh->dir_lights));
+    mesh->ambient_light_color = v->ambient_light_color;
+    mesh->background_top = v->background_top;
+    mesh->background_bottom = v->background_bottom;
+}
+
+// find_map returns the GNS file of a map, or NULL if the disc doesn't
+// have one.
+const disc_file_t* find_map(disc_t* disc, int map)
+{
+    char path[DISC_PATH_MAX];
+    snprintf(path, sizeof(path), "MAP/MAP%03d.GNS", map);
+    return iso_find(disc, path);
+}
+
+static bool is_mesh_record(const record_t* record)
+{
+    return record->type == ResourceMeshPrimary || record->type == ResourceMeshOverride || record->type == ResourceMeshAlt;
+}
+
+static bool is_record_for(const record_t* record, map_state_t state)
+{
+    return record->arrangement == state.arrangement && record->time == state.time && record->weather == state.weather;
+}
+
+// add_state adds a record's state to `states` if it isn't there yet.
+static void add_state(const record_t* record, map_state_t* states, u32* num_states)
+{
+    for (u32 i = 0; i < *num_states; i++) {
+        if (is_record_for(record, states[i])) {
+            return;
+        }
+    }
+    if (*num_states == MESH_MAX_VARIANTS) {
+        printf("too many map states\n");
+        return;
+    }
+    states[(*num_states)++] = (map_state_t) { record->arrangement, record->time, record->weather };
+}
+
+// read_states lists the states a map's records are for. The first is the
+// state of the last primary mesh, which is the one shown by default.
+//
+// Sometimes there is no primary mesh (ie MAP002.GNS), there is only an
+// override. Usually a non-battle map. Then the first override's state is
+// the default.
+static u32 read_states(const record_t* records, u16 num_records, map_state_t* out_states)
+{
+    i32 first = -1;
+    for (i32 i = 0; i < num_records; i++) {
+        if (records[i].type == ResourceMeshPrimary) {
+            first = i;
+        }
+    }
+    for (i32 i = 0; i < num_records && first == -1; i++) {
+        if (records[i].type == ResourceMeshOverride) {
+            first = i;
+        }
+    }
+
+    u32 num_states = 0;
+    if (first != -1) {
+        add_state(&records[first], out_states, &num_states);
+    }
+    for (i32 i = 0; i < num_records; i++) {
+        if (records[i].type == ResourceTexture || is_mesh_record(&records[i])) {
+            add_state(&records[i], out_states, &num_states);
+        }
+    }
+    return num_states;
+}
+
+// last_record returns the last record for `state` that `has` is true for,
+// or -1 if there isn't one.
+static i32 last_record(const resources_t* resources, u16 num_records, map_state_t state, bool (*has)(const resources_t*, u32))
+{
+    i32 last = -1;
+    for (u32 i = 0; i < num_records; i++) {
+        if (is_record_for(&resources->records[i], state) && has(resources, i)) {
+            last = i;
+        }
+    }
+    return last;
+}
+
+static bool has_texture(const resources_t* resources, u32 index)
+{
+    return resources->records[index].type == ResourceTexture;
+}
+
+static bool has_polygons(const resources_t* resources, u32 index)
+{
+    return is_mesh_record(&resources->records[index]) && resources->mesh_records[index].has_polygons;
+}
+
+static bool has_palette(const resources_t* resources, u32 index)
+{
+    return is_mesh_record(&resources->records[index]) && resources->mesh_records[index].has_palette;
+}
+
+static bool has_lights(const resources_t* resources, u32 index)
+{
+    return is_mesh_record(&resources->records[index]) && resources->mesh_records[index].has_lights;
+}
+
+// pick_textures decides which texture each state uses, and where each
+// used texture record goes in the mesh's textures. States without a
+// texture of their own use the default state's. If that has none, it is
+// the last texture, as when only one texture was read.
+static bool pick_textures(resources_t* resources, u16 num_records, const map_state_t* states, u32 num_states)
+{
+    mesh_t* mesh = resources->mesh;
+    i32 fallback = -1;
+    for (u32 i = 0; i < num_records; i++) {
+        resources->texture_slots[i] = -1;
+        if (has_texture(resources, i)) {
+            fallback = i;
+        }
+    }
+
+    u32 num_textures = 0;
+    i32 default_index = -1;
+    for (u32 s = 0; s < num_states; s++) {
+        i32 index = last_record(resources, num_records, states[s], has_texture);
+        if (index == -1) {
+            index = s == 0 ? fallback : default_index;
+        }
+        if (s == 0) {
+            default_index = index;
+        }
+        if (index == -1) {
+            mesh->variants[s].texture = 0;
+            continue;
+        }
+        if (resources->texture_slots[index] == -1) {
+            if (num_textures == MESH_MAX_TEXTURES) {
+                printf("too many textures\n");
+                return false;
+            }
+            resources->texture_slots[index] = num_textures++;
+        }
+        mesh->variants[s].texture = resources->texture_slots[index];
+    }
+
+    // Maps without a texture are drawn with an empty one.
+    if (num_textures == 0) {
+        if (!mesh_alloc_textures(mesh, 1)) {
+            return false;
+        }
+        memset(mesh->textures, 0, TEXTURE_NUM_BYTES);
+        return true;
+    }
+    mesh->is_texture_valid = true;
+    return mesh_alloc_textures(mesh, num_textures);
+}
+
+static void changes_job(void* data)
+{
+    resource_t* resource = data;
+    resources_t* resources = resource->resources;
+    mesh_record_t* base = resources->base == -1 ? NULL : &resources->mesh_records[resources->base];
+    const file_t* base_f = resources->base == -1 ? NULL : &resources->resources[resources->base].file;
+    if (!decode_changes(&resource->file, &resources->mesh_records[resource->index], base_f, base)) {
+        atomic_store(&resources->failed, true);
+    }
+}
+
+// decode_state_polygons decodes the polygons each state uses that
+// weren't decoded as they were read. The default state's are decoded
+// first, and the rest are decoded against them.
+static bool decode_state_polygons(resources_t* resources, u16 num_records, const map_state_t* states, u32 num_states)
+{
+    mesh_record_t* records = resources->mesh_records;
+    resources->base = num_states == 0 ? -1 : last_record(resources, num_records, states[0], has_polygons);
+    if (resources->base != -1 && !records[resources->base].is_decoded) {
+        if (!decode_mesh(&resources->resources[resources->base].file, &records[resources->base], resources->jobs)) {
+            printf("failed to read mesh\n");
+            return false;
+        }
+    }
+
+    bool is_submitted[RECORD_MAX_NUM] = { 0 };
+    for (u32 s = 1; s < num_states; s++) {
+        i32 index = last_record(resources, num_records, states[s], has_polygons);
+        if (index == -1 || records[index].is_decoded || is_submitted[index]) {
+            continue;
+        }
+        is_submitted[index] = true;
+        if (resources->jobs != NULL) {
+            job_t job = { .fn = changes_job, .data = &resources->resources[index] };
+            jobs_submit(resources->jobs, &job, 1, &resources->counter);
+        } else {
+            changes_job(&resources->resources[index]);
+        }
+    }
+    if (resources->jobs != NULL) {
+        jobs_wait(resources->jobs, &resources->counter);
+    }
+    if (atomic_load(&resources->failed)) {
+        printf("failed to read mesh\n");
+        return false;
+    }
+    return true;
+}
+
+// build_variants puts together each state from its records. Each takes
+// its polygons, palette and lights from the last record for it that has
+// them, or else from the default state. Geometry is copied into the mesh
+// once for every record that is used, and records decoded as changes to
+// the default state's polygons become patches of geometry 0.
+static bool build_variants(resources_t* resources, u16 num_records, const map_state_t* states, u32 num_states)
+{
+    mesh_t* mesh = resources->mesh;
+    i32 polygons[MESH_MAX_VARIANTS];
+    i32 geometries[RECORD_MAX_NUM];
+    u32 num_vertices = 0;
+    u32 num_indices = 0;
+    for (u32 i = 0; i < num_records; i++) {
+        geometries[i] = -1;
+    }
+
+    for (u32 s = 0; s < num_states; s++) {
+        variant_t* variant = &mesh->variants[s];
+        i32 palette = last_record(resources, num_records, states[s], has_palette);
+        i32 lights = last_record(resources, num_records, states[s], has_lights);
+        polygons[s] = last_record(resources, num_records, states[s], has_polygons);
+
+        const variant_t* fallback = s == 0 ? NULL : &mesh->variants[0];
+        if (palette != -1) {
+            memcpy(variant->palette, resources->mesh_records[palette].variant.palette, PALETTE_NUM_BYTES);
+        } else if (fallback != NULL) {
+            memcpy(variant->palette, fallback->palette, PALETTE_NUM_BYTES);
+        }
+        const variant_t* lit = lights != -1 ? &resources->mesh_records[lights].variant : fallback;
+        if (lit != NULL) {
+            memcpy(variant->dir_lights, lit->dir_lights, sizeof(variant->dir_lights));
+            variant->ambient_light_color = lit->ambient_light_color;
+            variant->background_top = lit->background_top;
+            variant->background_bottom = lit->background_bottom;
+        }
+        variant->state = states[s];
+
+        // A record that changes nothing draws as the default state.
+        if (polygons[s] == -1 || (resources->mesh_records[polygons[s]].is_delta && resources->mesh_records[polygons[s]].num_patches == 0)) {
+            polygons[s] = s == 0 ? -1 : polygons[0];
+        }
+        if (polygons[s] != -1 && geometries[polygons[s]] == -1) {
+            if (mesh->num_geometries == MESH_MAX_GEOMETRIES) {
+                printf("too many geometries\n");
+                return false;
+            }
+            const mesh_record_t* record = &resources->mesh_records[polygons[s]];
+            geometries[polygons[s]] = mesh->num_geometries;
+            mesh->geometries[mesh->num_geometries++] = (geometry_t) {
+                .first_vertex = num_vertices,
+                .num_vertices = record->num_vertices,
+                .first_index = num_indices,
+                .num_indices = record->num_indices,
+                .first_patch = mesh->num_patches,
+                .num_patches = record->num_patches,
+                .bounds = record->bounds,
+            };
+            num_vertices += record->num_vertices;
+            num_indices += record->num_indices;
+            mesh->num_patches += record->num_patches;
+        }
+        variant->geometry = polygons[s] == -1 ? 0 : (u32)geometries[polygons[s]];
+    }
+    mesh->num_variants = num_states;
+
+    // A map without polygons still gets an empty geometry to draw.
+    if (mesh->num_geometries == 0) {
+        mesh->geometries[0].bounds = aabb_empty();
+        mesh->num_geometries = 1;
+    }
+    // Decoded vertices are only kept until they are packed. One more than
+    // needed, so a map without polygons still gets a buffer.
+    mesh->vertices = malloc((num_vertices + 1) * sizeof(vertex_t));
+    if (mesh->vertices == NULL || !mesh_alloc(mesh, num_vertices, num_indices, mesh->geometries[0].num_indices)) {
+        return false;
+    }
+    mesh->num_vertices = num_vertices;
+    mesh->num_indices = num_indices;
+    for (u32 i = 0; i < num_records; i++) {
+        if (geometries[i] == -1) {
+            continue;
+        }
+        const mesh_record_t* record = &resources->mesh_records[i];
+        const geometry_t* geometry = &mesh->geometries[geometries[i]];
+        memcpy(&mesh->vertices[geometry->first_vertex], record->vertices, record->num_vertices * sizeof(vertex_t));
+        memcpy(&mesh->indices[geometry->first_index], record->indices, record->num_indices * sizeof(u16));
+        for (u32 p = 0; p < record->num_patches; p++) {
+            patch_t patch = record->patches[p];
+            patch.source += geometry->first_index;
+            mesh->patches[geometry->first_patch + p] = patch;
+        }
+    }
+
+    // Every variant is centered the same, on the default one.
+    if (polygons[0] != -1) {
+        mesh->center_transform = mesh_center_transform(mesh->geometries[mesh->variants[0].geometry].bounds);
+        mesh->is_mesh_valid = true;
+    }
+    return true;
+}
+
+// chunk_grid_t is the grid of squares a geometry is chunked on, from the
+// corner of its bounds on x and z.
+typedef struct {
+    f32 x;
+    f32 z;
+    f32 size;
+    u32 columns;
+    u32 rows;
+} chunk_grid_t;
+
+static chunk_grid_t chunk_grid(aabb_t bounds)
+{
+    f32 width = bounds.max.x - bounds.min.x;
+    f32 depth = bounds.max.z - bounds.min.z;
+    f32 size = fmaxf(MESH_CHUNK_SIZE, fmaxf(width, depth) / MESH_CHUNK_GRID);
+    return (chunk_grid_t) {
+        .x = bounds.min.x,
+        .z = bounds.min.z,
+        .size = size,
+        .columns = (u32)fmaxf(ceilf(width / size), 1.0f),
+        .rows = (u32)fmaxf(ceilf(depth / size), 1.0f),
+    };
+}
+
+// chunk_cell returns the square a triangle's center is in.
+static u32 chunk_cell(const chunk_grid_t* grid, const vertex_t* vertices, const u16* triangle)
+{
+    vec3 a = vertices[triangle[0]].position;
+    vec3 b = vertices[triangle[1]].position;
+    vec3 c = vertices[triangle[2]].position;
+    f32 x = (a.x + b.x + c.x) / 3.0f;
+    f32 z = (a.z + b.z + c.z) / 3.0f;
+    u32 column = (u32)clamp((x - grid->x) / grid->size, 0.0f, (f32)(grid->columns - 1));
+    u32 row = (u32)clamp((z - grid->z) / grid->size, 0.0f, (f32)(grid->rows - 1));
+    return (row * grid->columns) + column;
+}
+
+static u32 num_shared_corners(const u16* a, const u16* b)
+{
+    u32 count = 0;
+    for (u32 i = 0; i < 3; i++) {
+        count += a[i] == b[0] || a[i] == b[1] || a[i] == b[2];
+    }
+    return count;
+}
+
+static aabb_t triangle_bounds(const vertex_t* vertices, const u16* indices, u32 num_indices)
+{
+    aabb_t bounds = aabb_empty();
+    for (u32 i = 0; i < num_indices; i++) {
+        vec3 p = vertices[indices[i]].position;
+        bounds = aabb_merge(bounds, (aabb_t) { p, p });
+    }
+    return bounds;
+}
+
+// patched_bounds returns the bounds of a patched range of geometry 0's
+// indices, with every patch of it.
+static aabb_t patched_bounds(const mesh_t* mesh, u32 first, u32 end)
+{
+    const geometry_t* base = &mesh->geometries[0];
+    aabb_t bounds = triangle_bounds(&mesh->vertices[base->first_vertex], &mesh->indices[base->first_index + first], end - first);
+    for (u32 i = 1; i < mesh->num_geometries; i++) {
+        const geometry_t* geometry = &mesh->geometries[i];
+        for (u32 p = 0; p < geometry->num_patches; p++) {
+            const patch_t* patch = &mesh->patches[geometry->first_patch + p];
+            if (patch->first_index >= first && patch->first_index < end) {
+                aabb_t patch_bounds = triangle_bounds(&mesh->vertices[geometry->first_vertex], &mesh->indices[patch->source], patch->num_indices);
+                bounds = aabb_merge(bounds, patch_bounds);
+            }
+        }
+    }
+    return bounds;
+}
+
+// add_chunk adds a chunk after the last one, which is the geometry's. Once
+// there are `limit` chunks the geometry's last chunk grows instead.
+static void add_chunk(mesh_t* mesh, geometry_t* geometry, u32 first_index, u32 num_indices, aabb_t bounds, u32 limit)
+{
+    if (geometry->num_chunks > 0 && mesh->num_chunks >= limit) {
+        chunk_t* last = &mesh->chunks[mesh->num_chunks - 1];
+        last->num_indices = first_index + num_indices - last->first_index;
+        last->bounds = aabb_merge(last->bounds, bounds);
+        return;
+    }
+    mesh->chunks[mesh->num_chunks++] = (chunk_t) { first_index, num_indices, bounds };
+    geometry->num_chunks++;
+}
+
+// chunk_run sorts the triangles of a run of a geometry's indices by the
+// square they are in, and adds a chunk for each square.
+static void chunk_run(mesh_t* mesh, geometry_t* geometry, const chunk_grid_t* grid, u32 first, u32 end, u32 limit)
+{
+    const vertex_t* vertices = &mesh->vertices[geometry->first_vertex];
+    u16* indices = &mesh->indices[geometry->first_index];
+    u32 num_cells = grid->columns * grid->rows;
+
+    // offsets[cell + 1] starts as the cell's count of indices.
+    u16 cells[MAX_INDICES / 3];
+    u32 offsets[(MESH_CHUNK_GRID * MESH_CHUNK_GRID) + 1] = { 0 };
+    bool is_pair = false;
+    for (u32 i = first; i < end; i += 3) {
+        // A quad's triangles share an edge, and go in the same square so
+        // they still share their vertices in the cache. Only pairs are
+        // kept together, so a strip can't take up a whole run.
+        is_pair = !is_pair && i > first && num_shared_corners(&indices[i - 3], &indices[i]) >= 2;
+        u16 cell = is_pair ? cells[((i - first) / 3) - 1] : (u16)chunk_cell(grid, vertices, &indices[i]);
+        cells[(i - first) / 3] = cell;
+        offsets[cell + 1] += 3;
+    }
+    for (u32 c = 0; c < num_cells; c++) {
+        offsets[c + 1] += offsets[c];
+    }
+
+    u16 sorted[MAX_INDICES];
+    u32 next[MESH_CHUNK_GRID * MESH_CHUNK_GRID];
+    memcpy(next, offsets, num_cells * sizeof(u32));
+    for (u32 i = first; i < end; i += 3) {
+        u16 cell = cells[(i - first) / 3];
+        memcpy(&sorted[next[cell]], &indices[i], 3 * sizeof(u16));
+        next[cell] += 3;
+    }
+    memcpy(&indices[first], sorted, (end - first) * sizeof(u16));
+
+    for (u32 c = 0; c < num_cells; c++) {
+        u32 count = offsets[c + 1] - offsets[c];
+        if (count > 0) {
+            u32 start = first + offsets[c];
+            add_chunk(mesh, geometry, start, count, triangle_bounds(vertices, &indices[start], count), limit);
+        }
+    }
+}
+
+// build_chunks splits each geometry that isn't patches into chunks.
+// Triangles only move within runs that no geometry patches, so patches
+// still line up with what they replace.
+static void build_chunks(mesh_t* mesh)
+{
+    for (u32 i = 0; i < mesh->num_geometries; i++) {
+        geometry_t* geometry = &mesh->geometries[i];
+        geometry->first_chunk = mesh->num_chunks;
+        geometry->num_chunks = 0;
+        u32 num_triangles = geometry->num_indices / 3;
+        if (geometry->num_patches > 0 || num_triangles == 0) {
+            continue;
+        }
+
+        // Leave a chunk for each geometry after this one.
+        u32 limit = MESH_MAX_CHUNKS - (mesh->num_geometries - 1 - i);
+        chunk_grid_t grid = chunk_grid(geometry->bounds);
+
+        bool is_patched[MAX_INDICES / 3] = { 0 };
+        for (u32 p = 0; i == 0 && p < mesh->num_patches; p++) {
+            const patch_t* patch = &mesh->patches[p];
+            for (u32 t = patch->first_index / 3; t < (patch->first_index + patch->num_indices) / 3; t++) {
+                is_patched[t] = true;
+            }
+        }
+
+        u32 run = 0;
+        for (u32 t = 1; t <= num_triangles; t++) {
+            if (t < num_triangles && is_patched[t] == is_patched[run]) {
+                continue;
+            }
+            if (is_patched[run]) {
+                add_chunk(mesh, geometry, run * 3, (t - run) * 3, patched_bounds(mesh, run * 3, t * 3), limit);
+            } else {
+                chunk_run(mesh, geometry, &grid, run * 3, t * 3, limit);
+            }
+            run = t;
+        }
+    }
+}
+
+// read_map reads and decodes a map, with a variant for every state its
+// records are for. With a job system, resources are decoded on it while
+// the rest are still being read.
+bool read_map(disc_t* disc, int map, jobs_t* jobs, mesh_t* mesh)
+{
+    const disc_file_t* gns_file = find_map(disc, map);
+    if (gns_file == NULL) {
+        printf("map %d not found\n", map);
+        return false;
+    }
 
     file_t gns = { 0 };
-    if (!read_file(f, sector, GNS_MAX_SIZE, &gns)) {
+    if (!read_file(disc, gns_file->sector, gns_file->len, &gns)) {
         printf("failed to read gns\n");
         return false;
     }
 
     record_t records[RECORD_MAX_NUM] = { 0 };
     u16 num_records = { 0 };
-    if (!read_records(&gns, records, &num_records)) {
+    bool records_ok = read_records(&gns, records, &num_records);
+    file_free(&gns);
+    if (!records_ok) {
         printf("failed to read records\n");
         return false;
     }
 
+    // Resources are decoded in whatever order they are read, so which
+    // textures are used is decided up front. Which mesh record each part
+    // of a variant comes from depends on what the records hold, so every
+    // mesh record's header is read first. Then the polygons the variants
+    // use are decoded and the variants are put together.
+    resources_t* resources = calloc(1, sizeof(resources_t));
+    mesh_record_t* mesh_records = calloc(num_records + 1, sizeof(mesh_record_t));
+    if (resources == NULL || mesh_records == NULL) {
+        free(resources);
+        free(mesh_records);
+        return false;
+    }
+    resources->records = records;
+    resources->mesh = mesh;
+    resources->mesh_records = mesh_records;
+    resources->jobs = jobs;
+    atomic_init(&resources->counter.pending, 0);
+    atomic_init(&resources->failed, false);
+
+    map_state_t states[MESH_MAX_VARIANTS];
+    u32 num_states = read_states(records, num_records, states);
+    bool success = pick_textures(resources, num_records, states, num_states);
+
+    // Every resource is read at once and decoded as it arrives.
+    file_request_t requests[RECORD_MAX_NUM];
+    for (int i = 0; i < num_records; i++) {
+        requests[i] = (file_request_t) { .sector = records[i].sector, .size = records[i].len };
+        resources->resources[i] = (resource_t) { .resources = resources, .index = i };
+    }
+    if (success && !read_files(disc, requests, num_records, read_resource, resources)) {
+        printf("failed to read resources\n");
+        success = false;
+    }
+    if (jobs != NULL) {
+        jobs_wait(jobs, &resources->counter);
+        for (int i = 0; i < num_records; i++) {
+            if (!is_mesh_record(&records[i])) {
+                file_free(&resources->resources[i].file);
+            }
+        }
+    }
+
+    success = success && !atomic_load(&resources->failed)
+        && decode_state_polygons(resources, num_records, states, num_states)
+        && build_variants(resources, num_records, states, num_states);
+    if (success) {
+        build_chunks(mesh);
+        mesh_set_variant(mesh, 0);
+    }
+
     for (int i = 0; i < num_records; i++) {
-        record_t record = records[i];
+        file_free(&resources->resources[i].file);
+        free(mesh_records[i].vertices);
+        free(mesh_records[i].indices);
+    }
+    free(mesh_records);
+    free(resources);
+    return success;
+}
 
-        file_t resource = { 0 };
-        if (!read_file(f, record.sector, record.len, &resource)) {
-            printf("failed to read resource\n");
+// decode_resource decodes a texture or mesh record. Only the polygons of
+// primary mesh records are decoded here. The rest are decoded by
+// decode_changes once it is known what they are changes to.
+static bool decode_resource(resources_t* resources, u32 index, file_t* f)
+{
+    if (resources->records[index].type == ResourceTexture) {
+        u8* texture = &resources->mesh->textures[(u64)resources->texture_slots[index] * TEXTURE_NUM_BYTES];
+        if (!read_texture(f, texture)) {
+            printf("failed to read texture\n");
             return false;
         }
+        return true;
+    }
+    mesh_record_t* record = &resources->mesh_records[index];
+    bool is_primary = resources->records[index].type == ResourceMeshPrimary;
+    if (!read_mesh_header(f, record) || (is_primary && record->has_polygons && !decode_mesh(f, record, resources->jobs))) {
+        printf("failed to read mesh\n");
+        return false;
+    }
+    return true;
+}
 
-        switch (record.type) {
-        case ResourceMeshPrimary:
-            if (!read_mesh(&resource, mesh)) {
-                printf("failed to read mesh\n");
-                return false;
-            }
-            break;
-        case ResourceTexture:
-            if (!read_texture(&resource, mesh)) {
-                printf("failed to read texture\n");
-                return false;
-            }
-            break;
-        case ResourceMeshOverride:
-            // Sometimes there is no primary mesh (ie MAP002.GNS), there is
-            // only an override. Usually a non-battle map. So we treat this
-            // one as the primary, only if the primary hasn't been set. Kinda
-            // Hacky until we start treating each GNS Record as a Scenario.
-            if (!mesh->is_mesh_valid) {
-                if (!read_mesh(&resource, mesh)) {
-                    printf("failed to read alt mesh\n");
-                    return false;
-                }
-            }
-            break;
-        default:
-            break;
-        }
+static void resource_job(void* data)
+{
+    resource_t* resource = data;
+    if (!decode_resource(resource->resources, resource->index, &resource->file)) {
+        atomic_store(&resource->resources->failed, true);
     }
+}
 
-    return true;
+// read_resource decodes a single GNS record, if it is a mesh or one of
+// the textures picked by read_map.
+static bool read_resource(u32 index, file_t* f, void* user)
+{
+    resources_t* resources = user;
+    const record_t* record = &resources->records[index];
+    if (!is_mesh_record(record) && resources->texture_slots[index] == -1) {
+        return true;
+    }
+
+    // With a job system the file is taken over by the resource's job.
+    // Mesh records are always taken over, to be compared later.
+    resource_t* resource = &resources->resources[index];
+    if (resources->jobs != NULL || is_mesh_record(record)) {
+        resource->file = *f;
+        *f = (file_t) { 0 };
+        f = &resource->file;
+    }
+    if (resources->jobs != NULL) {
+        job_t job = { .fn = resource_job, .data = resource };
+        jobs_submit(resources->jobs, &job, 1, &resources->counter);
+        return true;
+    }
+    return decode_resource(resources, index, f);
 }
 
 bool read_records(file_t* f, record_t* out_records, u16* out_num_records)
@@ -120,271 +935,486 @@ bool read_records(file_t* f, record_t* out_records, u16* out_num_records)
     }
 }
 
-bool read_mesh(file_t* f, mesh_t* mesh)
+// read_triplets decodes `count` packed i16 triplets at `offset` with one
+// of the bulk decoders. Triplets past the end of the file are zero, as
+// they would be with read_position.
+static void read_triplets(const file_t* f, u32 offset, u32 count, void (*decode)(const u8*, u32, vec3*), vec3* out)
 {
-    // 0x40 is always the location of the primary mesh pointer.
-    // 0xC4 is always the primary mesh pointer.
-    f->offset = 0x40;
-    u32 primary_mesh_ptr = read_u32(f);
-    assert(primary_mesh_ptr == 0xC4);
-    f->offset = primary_mesh_ptr;
+    u64 available = offset < f->len ? (f->len - offset) / 6 : 0;
+    u32 num_decoded = available < count ? (u32)available : count;
+    decode(&f->data[offset], num_decoded, out);
+    memset(&out[num_decoded], 0, (count - num_decoded) * sizeof(vec3));
+}
 
-    // The number of each type of polygon.
-    u16 N = read_u16(f); // Textured triangles
-    u16 P = read_u16(f); // Textured quads
-    u16 Q = read_u16(f); // Untextured triangles
-    u16 R = read_u16(f); // Untextured quads
+// read_bounded_positions is read_triplets for positions, growing `bounds`
+// by them as they are decoded. Positions past the end of the file are at
+// the origin.
+static void read_bounded_positions(const file_t* f, u32 offset, u32 count, const vertex_decoder_t* decoder, vec3* out, aabb_t* bounds)
+{
+    u64 available = offset < f->len ? (f->len - offset) / 6 : 0;
+    u32 num_decoded = available < count ? (u32)available : count;
+    decoder->bounded_positions(&f->data[offset], num_decoded, out, bounds);
+    if (num_decoded < count) {
+        memset(&out[num_decoded], 0, (count - num_decoded) * sizeof(vec3));
+        *bounds = aabb_merge(*bounds, (aabb_t) { 0 });
+    }
+}
 
-    // Validate maximum values
-    if (N > 512 || P > 768 || Q > 64 || R > 256) {
-        return false;
+// section_bytes returns `len` bytes at `offset`. Bytes past the end of the
+// file are zero, as they would be with read_u8, so those are copied to
+// `scratch` first.
+static const u8* section_bytes(const file_t* f, u32 offset, u32 len, u8* scratch)
+{
+    if (offset + len <= f->len) {
+        return &f->data[offset];
+    }
+    memset(scratch, 0, len);
+    if (offset < f->len) {
+        memcpy(scratch, &f->data[offset], f->len - offset);
+    }
+    return scratch;
+}
+
+// decode_polygons decodes a section in one pass. The positions and normals
+// are decoded in bulk first, then each output vertex is written once from
+// its corner's position, normal and UV. It is inlined with a constant
+// `kind`, so each kind of polygon gets its own loop.
+static inline __attribute__((always_inline)) void decode_polygons(mesh_section_t* section, const u32 kind)
+{
+    const polygon_kind_t* k = &polygon_kinds[kind];
+    const vertex_decoder_t* decoder = vertex_decoder_best();
+    u32 num_triplets = section->num_polygons * k->num_corners;
+    vertex_t* out = &section->vertices[section->first_vertex];
+
+    vec3 positions[MESH_JOB_POLYGONS * 4];
+    vec3 normals[MESH_JOB_POLYGONS * 4];
+    u8 scratch[MESH_JOB_POLYGONS * 12];
+    const u8* uvs = NULL;
+    read_bounded_positions(section->f, section->positions, num_triplets, decoder, positions, &section->bounds);
+    if (k->is_textured) {
+        read_triplets(section->f, section->normals, num_triplets, decoder->normals, normals);
+        uvs = section_bytes(section->f, section->uvs, section->num_polygons * k->uv_size, scratch);
+    }
+
+    for (u32 i = 0; i < section->num_polygons; i++) {
+        const vec3* position = &positions[i * k->num_corners];
+        const vec3* normal = &normals[i * k->num_corners];
+
+        vec2 texcoords[4] = { 0 };
+        f32 palette = 0.0f;
+        if (k->is_textured) {
+            const u8* uv = &uvs[i * k->uv_size];
+            palette = uv[2];
+            u8 page = uv[6] & 0x03; // 0b00000011
+            for (u32 c = 0; c < k->num_corners; c++) {
+                texcoords[c] = process_tex_coords(uv[uv_offsets[c]], uv[uv_offsets[c] + 1], page);
+            }
+        }
+
+        for (u32 v = 0; v < k->num_vertices; v++) {
+            u32 c = k->corners[v];
+            *out++ = (vertex_t) {
+                .position = position[c],
+                .normal = k->is_textured ? normal[c] : (vec3) { 0 },
+                .texcoords = texcoords[c],
+                .palette = palette,
+            };
+        }
+    }
+}
+
+// read_section decodes a section with the loop for its kind.
+static void read_section(mesh_section_t* section)
+{
+    switch (section->kind) {
+    case PolygonTexturedTriangle:
+        decode_polygons(section, PolygonTexturedTriangle);
+        break;
+    case PolygonTexturedQuad:
+        decode_polygons(section, PolygonTexturedQuad);
+        break;
+    case PolygonTriangle:
+        decode_polygons(section, PolygonTriangle);
+        break;
+    case PolygonQuad:
+        decode_polygons(section, PolygonQuad);
+        break;
     }
+}
 
-    int index = 0;
+static void section_job(void* data)
+{
+    read_section(data);
+}
 
-    // Textured triangle vertices
-    for (int i = index; i < N * 3; i = i + 3) {
-        mesh->vertices[i + 0].position = read_position(f);
-        mesh->vertices[i + 1].position = read_position(f);
-        mesh->vertices[i + 2].position = read_position(f);
+static u32 hash_vertex(const vertex_t* vertex)
+{
+    u32 words[sizeof(vertex_t) / sizeof(u32)];
+    memcpy(words, vertex, sizeof(words));
+    u32 hash = 2166136261u;
+    for (u32 i = 0; i < sizeof(words) / sizeof(u32); i++) {
+        hash = (hash ^ words[i]) * 16777619u;
     }
+    return hash ^ (hash >> 15);
+}
 
-    index = index + (N * 3);
+// weld_vertices fills the record with the unique vertices of `corners`
+// and an index per corner. Vertices are only welded when every attribute
+// is identical. It fails if there are more than MAX_VERTS unique vertices.
+static bool weld_vertices(const vertex_t* corners, u32 num_corners, mesh_record_t* record)
+{
+    // Slots hold a vertex index plus one, zero is empty.
+    u16 table[WELD_TABLE_SIZE] = { 0 };
+
+    record->num_vertices = 0;
+    record->num_indices = num_corners;
+    for (u32 i = 0; i < num_corners; i++) {
+        const vertex_t* corner = &corners[i];
+        u32 slot = hash_vertex(corner) & (WELD_TABLE_SIZE - 1);
+        while (table[slot] != 0 && memcmp(&record->vertices[table[slot] - 1], corner, sizeof(vertex_t)) != 0) {
+            slot = (slot + 1) & (WELD_TABLE_SIZE - 1);
+        }
 
-    // Textured quad vertices. Split into 2 triangles.
-    for (int i = index; i < index + (P * 2 * 3); i = i + 6) {
-        vec3 a = read_position(f);
-        vec3 b = read_position(f);
-        vec3 c = read_position(f);
-        vec3 d = read_position(f);
+        if (table[slot] == 0) {
+            if (record->num_vertices == MAX_VERTS) {
+                return false;
+            }
+            record->vertices[record->num_vertices] = *corner;
+            table[slot] = (u16)(++record->num_vertices);
+        }
+        record->indices[i] = table[slot] - 1;
+    }
+    return true;
+}
+
+// add_sections splits a run of polygons into sections of at most
+// MESH_JOB_POLYGONS.
+static u32 add_sections(mesh_section_t* sections, mesh_section_t run)
+{
+    const polygon_kind_t* k = &polygon_kinds[run.kind];
+    u32 num_sections = 0;
+
+    for (u32 i = 0; i < run.num_polygons; i += MESH_JOB_POLYGONS) {
+        mesh_section_t section = run;
+        section.first_vertex = run.first_vertex + (i * k->num_vertices);
+        section.num_polygons = run.num_polygons - i;
+        if (section.num_polygons > MESH_JOB_POLYGONS) {
+            section.num_polygons = MESH_JOB_POLYGONS;
+        }
+        section.positions = run.positions + (i * k->num_corners * 6);
+        section.normals = run.normals + (i * k->num_corners * 6);
+        section.uvs = run.uvs + (i * k->uv_size);
+        sections[num_sections++] = section;
+    }
+    return num_sections;
+}
 
-        // Triangle A
-        mesh->vertices[i + 0].position = a;
-        mesh->vertices[i + 1].position = b;
-        mesh->vertices[i + 2].position = c;
+// read_mesh_header reads which parts a mesh record has, and reads the
+// palette, lights and background. The polygons are decoded separately.
+static bool read_mesh_header(file_t* f, mesh_record_t* record)
+{
+    // The polygons, palette and lights are at the pointers at 0x40, 0x44
+    // and 0x64. A record without one of them has a 0 pointer. The
+    // polygons are always at 0xC4 when they are there.
+    f->offset = 0x44;
+    record->has_palette = read_u32(f) != 0;
+    f->offset = 0x64;
+    record->has_lights = read_u32(f) != 0;
+    f->offset = 0x40;
+    u32 primary_mesh_ptr = read_u32(f);
+    if (primary_mesh_ptr != 0) {
+        assert(primary_mesh_ptr == 0xC4);
+        f->offset = primary_mesh_ptr;
+
+        // The number of each type of polygon.
+        u16 N = read_u16(f); // Textured triangles
+        u16 P = read_u16(f); // Textured quads
+        u16 Q = read_u16(f); // Untextured triangles
+        u16 R = read_u16(f); // Untextured quads
+
+        // Validate maximum values
+        if (N > 512 || P > 768 || Q > 64 || R > 256) {
+            return false;
+        }
+        record->counts[PolygonTexturedTriangle] = N;
+        record->counts[PolygonTexturedQuad] = P;
+        record->counts[PolygonTriangle] = Q;
+        record->counts[PolygonQuad] = R;
+        record->has_polygons = true;
+    }
+    return read_parts(f, record);
+}
+
+// layout_sections splits a record's polygons into sections. Polygons are
+// laid out as all the positions, then the normals and UVs of textured
+// polygons, each in N, P, Q, R order. The offset of every run follows from
+// the counts, so records with the same counts have the same sections.
+static u32 layout_sections(const file_t* f, const u16* counts, vertex_t* corners, mesh_section_t* sections)
+{
+    u32 positions_size = 0;
+    u32 normals_size = 0;
+    for (int i = 0; i < PolygonKindCount; i++) {
+        const polygon_kind_t* k = &polygon_kinds[i];
+        positions_size += counts[i] * k->num_corners * 6;
+        normals_size += k->is_textured ? counts[i] * k->num_corners * 6 : 0;
+    }
+
+    u32 num_sections = 0;
+    u32 first_vertex = 0;
+    u32 positions = 0xC4 + 8;
+    u32 normals = positions + positions_size;
+    u32 uvs = normals + normals_size;
+    for (int i = 0; i < PolygonKindCount; i++) {
+        const polygon_kind_t* k = &polygon_kinds[i];
+        mesh_section_t run = {
+            .f = f,
+            .vertices = corners,
+            .kind = i,
+            .first_vertex = first_vertex,
+            .num_polygons = counts[i],
+            .positions = positions,
+            .normals = k->is_textured ? normals : 0,
+            .uvs = k->is_textured ? uvs : 0,
+            .bounds = aabb_empty(),
+        };
+        num_sections += add_sections(&sections[num_sections], run);
+        first_vertex += counts[i] * k->num_vertices;
+        positions += counts[i] * k->num_corners * 6;
+        if (k->is_textured) {
+            normals += counts[i] * k->num_corners * 6;
+            uvs += counts[i] * k->uv_size;
+        }
+    }
+    return num_sections;
+}
+
+// num_record_corners returns the number of triangle corners of a record's
+// polygons, (N*3)+(P*3*2)+(Q*3)+(R*3*2).
+static u32 num_record_corners(const u16* counts)
+{
+    u32 num_corners = 0;
+    for (int i = 0; i < PolygonKindCount; i++) {
+        num_corners += counts[i] * polygon_kinds[i].num_vertices;
+    }
+    return num_corners;
+}
+
+// weld_record welds decoded corners into the record's vertices and
+// indices.
+static bool weld_record(const vertex_t* corners, u32 num_corners, mesh_record_t* record)
+{
+    record->vertices = malloc((num_corners + 1) * sizeof(vertex_t));
+    record->indices = malloc((num_corners + 1) * sizeof(u16));
+    if (record->vertices == NULL || record->indices == NULL || !weld_vertices(corners, num_corners, record)) {
+        printf("too many vertices\n");
+        return false;
+    }
+    record->is_decoded = true;
+    return true;
+}
 
-        // Triangle B
-        mesh->vertices[i + 3].position = b;
-        mesh->vertices[i + 4].position = d;
-        mesh->vertices[i + 5].position = c;
+// decode_mesh decodes all of a mesh record's polygons. With a job system
+// the sections are decoded in parallel.
+static bool decode_mesh(const file_t* f, mesh_record_t* record, jobs_t* jobs)
+{
+    // Polygons are decoded to a vertex per corner of each triangle, then
+    // welded into unique vertices and indices.
+    u32 num_corners = num_record_corners(record->counts);
+    // One extra so an empty mesh still gets an allocation.
+    vertex_t* corners = malloc((num_corners + 1) * sizeof(vertex_t));
+    if (corners == NULL) {
+        return false;
     }
 
-    index = index + (P * 2 * 3);
+    mesh_section_t sections[MESH_MAX_SECTIONS];
+    u32 num_sections = layout_sections(f, record->counts, corners, sections);
 
-    // Untextured triangle vertices
-    for (int i = index; i < index + (Q * 3); i = i + 3) {
-        mesh->vertices[i + 0].position = read_position(f);
-        mesh->vertices[i + 1].position = read_position(f);
-        mesh->vertices[i + 2].position = read_position(f);
+    if (jobs != NULL) {
+        job_counter_t counter;
+        atomic_init(&counter.pending, 0);
+        job_t batch[MESH_MAX_SECTIONS];
+        for (u32 i = 0; i < num_sections; i++) {
+            batch[i] = (job_t) { .fn = section_job, .data = &sections[i] };
+        }
+        jobs_submit(jobs, batch, num_sections, &counter);
+        jobs_wait(jobs, &counter);
+    } else {
+        for (u32 i = 0; i < num_sections; i++) {
+            read_section(&sections[i]);
+        }
     }
 
-    index = index + (Q * 3);
+    record->bounds = aabb_empty();
+    for (u32 i = 0; i < num_sections; i++) {
+        record->section_bounds[i] = sections[i].bounds;
+        record->bounds = aabb_merge(record->bounds, sections[i].bounds);
+    }
 
-    // Untextured quad vertices. Split into 2 triangles.
-    for (int i = index; i < index + (R * 2 * 3); i = i + 6) {
-        vec3 a = read_position(f);
-        vec3 b = read_position(f);
-        vec3 c = read_position(f);
-        vec3 d = read_position(f);
+    bool welded = weld_record(corners, num_corners, record);
+    free(corners);
+    return welded;
+}
 
-        // Triangle A
-        mesh->vertices[i + 0].position = a;
-        mesh->vertices[i + 1].position = b;
-        mesh->vertices[i + 2].position = c;
+// is_range_equal returns whether two files have the same bytes at
+// `offset`, reading past the end of either as zero.
+static bool is_range_equal(const file_t* a, const file_t* b, u32 offset, u32 len)
+{
+    u8 scratch_a[MESH_JOB_POLYGONS * 4 * 6];
+    u8 scratch_b[MESH_JOB_POLYGONS * 4 * 6];
+    return memcmp(section_bytes(a, offset, len, scratch_a), section_bytes(b, offset, len, scratch_b), len) == 0;
+}
 
-        // Triangle B
-        mesh->vertices[i + 3].position = b;
-        mesh->vertices[i + 4].position = d;
-        mesh->vertices[i + 5].position = c;
+// is_section_changed returns whether a section's polygons differ in
+// another record with the same counts.
+static bool is_section_changed(const mesh_section_t* section, const file_t* base_f)
+{
+    const polygon_kind_t* k = &polygon_kinds[section->kind];
+    u32 triplets_size = section->num_polygons * k->num_corners * 6;
+    if (!is_range_equal(section->f, base_f, section->positions, triplets_size)) {
+        return true;
     }
+    return k->is_textured
+        && (!is_range_equal(section->f, base_f, section->normals, triplets_size)
+            || !is_range_equal(section->f, base_f, section->uvs, section->num_polygons * k->uv_size));
+}
 
-    index = index + (R * 2 * 3);
+// decode_changes decodes a mesh record against `base`, which is already
+// decoded. Override records mostly repeat the primary's polygons, so only
+// the sections that differ from it are decoded, each becoming a patch of
+// the base's indices. A record with other counts is decoded in full.
+static bool decode_changes(const file_t* f, mesh_record_t* record, const file_t* base_f, const mesh_record_t* base)
+{
+    if (base == NULL || memcmp(record->counts, base->counts, sizeof(record->counts)) != 0) {
+        return decode_mesh(f, record, NULL);
+    }
 
-    // Record number of vertices.
-    // Should be equal to (N*3)+(P*3*2)+(Q*3)+(R*3*2)
-    mesh->num_vertices = index;
+    // Changed sections are decoded one after another into `corners`.
+    mesh_section_t sections[MESH_MAX_SECTIONS];
+    u32 num_sections = layout_sections(f, record->counts, NULL, sections);
+    bool is_changed[MESH_MAX_SECTIONS];
+    u32 num_corners = 0;
+    record->is_delta = true;
+    for (u32 i = 0; i < num_sections; i++) {
+        mesh_section_t* section = &sections[i];
+        is_changed[i] = is_section_changed(section, base_f);
+        if (!is_changed[i]) {
+            continue;
+        }
+        u32 section_corners = section->num_polygons * polygon_kinds[section->kind].num_vertices;
+
+        // A section next to the last changed one extends its patch.
+        patch_t* last = record->num_patches > 0 ? &record->patches[record->num_patches - 1] : NULL;
+        if (last != NULL && last->first_index + last->num_indices == section->first_vertex) {
+            last->num_indices += section_corners;
+        } else {
+            record->patches[record->num_patches++] = (patch_t) {
+                .first_index = section->first_vertex,
+                .num_indices = section_corners,
+                .source = num_corners,
+            };
+        }
+        section->first_vertex = num_corners;
+        num_corners += section_corners;
+    }
 
-    u32 expected_num_vertices = (u32)(N * 3) + (P * 3 * 2) + (Q * 3) + (R * 3 * 2);
-    if (mesh->num_vertices != expected_num_vertices) {
+    vertex_t* corners = malloc((num_corners + 1) * sizeof(vertex_t));
+    if (corners == NULL) {
         return false;
     }
+    record->bounds = aabb_empty();
+    for (u32 i = 0; i < num_sections; i++) {
+        if (is_changed[i]) {
+            sections[i].vertices = corners;
+            read_section(&sections[i]);
+        }
+        record->section_bounds[i] = is_changed[i] ? sections[i].bounds : base->section_bounds[i];
+        record->bounds = aabb_merge(record->bounds, record->section_bounds[i]);
+    }
 
-    // Reset index so we can start over for normals, using the same vertices.
-    index = 0;
-
-    // Triangle normals
-    for (int i = index; i < N * 3; i = i + 3) {
-        mesh->vertices[i + 0].normal = read_normal(f);
-        mesh->vertices[i + 1].normal = read_normal(f);
-        mesh->vertices[i + 2].normal = read_normal(f);
-    }
-
-    index = index + (N * 3);
-
-    // Quad normals. Split into 2 triangles.
-    for (int i = index; i < index + (P * 2 * 3); i = i + 6) {
-        vec3 a = read_normal(f);
-        vec3 b = read_normal(f);
-        vec3 c = read_normal(f);
-        vec3 d = read_normal(f);
-
-        // Triangle A
-        mesh->vertices[i + 0].normal = a;
-        mesh->vertices[i + 1].normal = b;
-        mesh->vertices[i + 2].normal = c;
-
-        // Triangle B
-        mesh->vertices[i + 3].normal = b;
-        mesh->vertices[i + 4].normal = d;
-        mesh->vertices[i + 5].normal = c;
-    }
-
-    // Reset index so we can start over for texture data, using the same vertices.
-    index = 0;
-
-    // Triangle UV
-    for (int i = index; i < N * 3; i = i + 3) {
-        f32 au = read_u8(f);
-        f32 av = read_u8(f);
-        f32 palette = read_u8(f);
-        (void)read_u8(f); // padding
-        f32 bu = read_u8(f);
-        f32 bv = read_u8(f);
-        f32 page = (read_u8(f) & 0x03); // 0b00000011
-        (void)read_u8(f);               // padding
-        f32 cu = read_u8(f);
-        f32 cv = read_u8(f);
-
-        vec2 a = process_tex_coords(au, av, page);
-        vec2 b = process_tex_coords(bu, bv, page);
-        vec2 c = process_tex_coords(cu, cv, page);
-
-        mesh->vertices[i + 0].texcoords = a;
-        mesh->vertices[i + 0].palette = palette;
-        mesh->vertices[i + 1].texcoords = b;
-        mesh->vertices[i + 1].palette = palette;
-        mesh->vertices[i + 2].texcoords = c;
-        mesh->vertices[i + 2].palette = palette;
-    }
-
-    index = index + (N * 3);
-
-    // Quad UV. Split into 2 triangles.
-    for (int i = index; i < index + (P * 2 * 3); i = i + 6) {
-        f32 au = read_u8(f);
-        f32 av = read_u8(f);
-        f32 palette = read_u8(f);
-        (void)read_u8(f); // padding
-        f32 bu = read_u8(f);
-        f32 bv = read_u8(f);
-        f32 page = (read_u8(f) & 0x03); // 0b00000011
-        (void)read_u8(f);               // padding
-        f32 cu = read_u8(f);
-        f32 cv = read_u8(f);
-        f32 du = read_u8(f);
-        f32 dv = read_u8(f);
-
-        vec2 a = process_tex_coords(au, av, page);
-        vec2 b = process_tex_coords(bu, bv, page);
-        vec2 c = process_tex_coords(cu, cv, page);
-        vec2 d = process_tex_coords(du, dv, page);
-
-        // Triangle A
-        mesh->vertices[i + 0].texcoords = a;
-        mesh->vertices[i + 0].palette = palette;
-        mesh->vertices[i + 1].texcoords = b;
-        mesh->vertices[i + 1].palette = palette;
-        mesh->vertices[i + 2].texcoords = c;
-        mesh->vertices[i + 2].palette = palette;
-
-        // Triangle B
-        mesh->vertices[i + 3].texcoords = b;
-        mesh->vertices[i + 3].palette = palette;
-        mesh->vertices[i + 4].texcoords = d;
-        mesh->vertices[i + 4].palette = palette;
-        mesh->vertices[i + 5].texcoords = c;
-        mesh->vertices[i + 5].palette = palette;
-    }
-
-    read_palette(f, mesh);
-    read_lights(f, mesh);
-    read_background(f, mesh);
-
-    mesh->center_transform = mesh_center_transform(mesh);
-
-    mesh->is_mesh_valid = true;
+    bool welded = weld_record(corners, num_corners, record);
+    free(corners);
+    return welded;
+}
+
+// read_parts reads the palette, lights and background a mesh record has.
+static bool read_parts(file_t* f, mesh_record_t* record)
+{
+    if (record->has_palette) {
+        read_palette(f, &record->variant);
+    }
+    if (record->has_lights) {
+        read_lights(f, &record->variant);
+        read_background(f, &record->variant);
+    }
     return true;
 }
 
 // 16 palettes of 16 colors of 4 bytes
-bool read_palette(file_t* f, mesh_t* mesh)
+bool read_palette(file_t* f, variant_t* variant)
 {
     f->offset = 0x44;
     u32 intra_file_ptr = read_u32(f);
     f->offset = intra_file_ptr;
 
+    if (f->offset + (PALETTE_NUM_BYTES / 2) <= f->len) {
+        decode_palette(&f->data[f->offset], PALETTE_NUM_BYTES / 4, variant->palette);
+        f->offset += PALETTE_NUM_BYTES / 2;
+        return true;
+    }
+
+    // A palette cut short by the end of the file reads as black.
     for (int i = 0; i < 16 * 16 * 4; i = i + 4) {
         vec4 c = read_rgb15(f);
-        mesh->palette[i + 0] = c.x;
-        mesh->palette[i + 1] = c.y;
-        mesh->palette[i + 2] = c.z;
-        mesh->palette[i + 3] = c.w;
+        variant->palette[i + 0] = c.x;
+        variant->palette[i + 1] = c.y;
+        variant->palette[i + 2] = c.z;
+        variant->palette[i + 3] = c.w;
     }
 
     return true;
 }
 
-bool read_lights(file_t* f, mesh_t* mesh)
+bool read_lights(file_t* f, variant_t* variant)
 {
     f->offset = 0x64;
     u32 intra_file_ptr = read_u32(f);
     f->offset = intra_file_ptr;
 
-    mesh->dir_lights[0].color.x = read_f1x3x12(f);
-    mesh->dir_lights[1].color.x = read_f1x3x12(f);
-    mesh->dir_lights[2].color.x = read_f1x3x12(f);
-    mesh->dir_lights[0].color.y = read_f1x3x12(f);
-    mesh->dir_lights[1].color.y = read_f1x3x12(f);
-    mesh->dir_lights[2].color.y = read_f1x3x12(f);
-    mesh->dir_lights[0].color.z = read_f1x3x12(f);
-    mesh->dir_lights[1].color.z = read_f1x3x12(f);
-    mesh->dir_lights[2].color.z = read_f1x3x12(f);
+    variant->dir_lights[0].color.x = read_f1x3x12(f);
+    variant->dir_lights[1].color.x = read_f1x3x12(f);
+    variant->dir_lights[2].color.x = read_f1x3x12(f);
+    variant->dir_lights[0].color.y = read_f1x3x12(f);
+    variant->dir_lights[1].color.y = read_f1x3x12(f);
+    variant->dir_lights[2].color.y = read_f1x3x12(f);
+    variant->dir_lights[0].color.z = read_f1x3x12(f);
+    variant->dir_lights[1].color.z = read_f1x3x12(f);
+    variant->dir_lights[2].color.z = read_f1x3x12(f);
 
-    mesh->dir_lights[0].position = read_position(f);
-    mesh->dir_lights[1].position = read_position(f);
-    mesh->dir_lights[2].position = read_position(f);
+    variant->dir_lights[0].position = read_position(f);
+    variant->dir_lights[1].position = read_position(f);
+    variant->dir_lights[2].position = read_position(f);
 
-    mesh->ambient_light_color = read_rgb8(f);
+    variant->ambient_light_color = read_rgb8(f);
 
     return true;
 }
 
-bool read_background(file_t* f, mesh_t* mesh)
+bool read_background(file_t* f, variant_t* variant)
 {
-    mesh->background_top = read_rgb8(f);
-    mesh->background_top = read_rgb8(f);
+    variant->background_top = read_rgb8(f);
+    variant->background_top = read_rgb8(f);
     return true;
 }
 
-bool read_texture(file_t* f, mesh_t* mesh)
+// read_texture copies the texture as it is stored, two 4-bit palette
+// indices per byte with the left pixel in the low nibble. It is unpacked
+// in the fragment shader.
+bool read_texture(file_t* f, u8* texture)
 {
-    u8 raw_pixels[TEXTURE_RAW_SIZE];
-    memcpy(&raw_pixels, f, TEXTURE_RAW_SIZE * sizeof(u8));
-
-    for (int i = 0, j = 0; i < TEXTURE_RAW_SIZE; i++, j += 8) {
-        u8 raw_pixel = raw_pixels[i];
-        u8 right = ((raw_pixel & 0x0F));
-        u8 left = ((raw_pixel & 0xF0) >> 4);
-        mesh->texture[j + 0] = right;
-        mesh->texture[j + 1] = right;
-        mesh->texture[j + 2] = right;
-        mesh->texture[j + 3] = right;
-        mesh->texture[j + 4] = left;
-        mesh->texture[j + 5] = left;
-        mesh->texture[j + 6] = left;
-        mesh->texture[j + 7] = left;
+    if (f->len < TEXTURE_NUM_BYTES) {
+        return false;
     }
-
+    memcpy(texture, f->data, TEXTURE_NUM_BYTES);
     return true;
 }
 
@@ -452,26 +1482,65 @@ static vec2 process_tex_coords(f32 u, f32 v, u8 page)
     return (vec2) { u, v };
 }
 
-static vec3 mesh_center_transform(mesh_t* mesh)
+// pack_normal encodes a normal with the octahedral mapping: the normal is
+// projected onto an octahedron, whose lower half is folded over the upper
+// half, leaving a point on a square.
+static void pack_normal(vec3 n, i16* out)
 {
-    vec3 vmin = { .x = FLT_MAX, .y = FLT_MAX, .z = FLT_MAX };
-    vec3 vmax = { .x = FLT_MIN, .y = FLT_MIN, .z = FLT_MIN };
-
-    for (u32 i = 0; i < mesh->num_vertices; i++) {
-        vec3 p = mesh->vertices[i].position;
+    f32 l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    if (l1 == 0.0f) {
+        out[0] = 0;
+        out[1] = 0;
+        return;
+    }
 
-        vmin.x = fmin(p.x, vmin.x);
-        vmin.y = fmin(p.y, vmin.y);
-        vmin.z = fmin(p.z, vmin.z);
+    f32 x = n.x / l1;
+    f32 y = n.y / l1;
+    if (n.z < 0.0f) {
+        f32 folded_x = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        f32 folded_y = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = folded_x;
+        y = folded_y;
+    }
+    out[0] = (i16)lroundf(x * 32767.0f);
+    out[1] = (i16)lroundf(y * 32767.0f);
+}
 
-        vmax.x = fmax(p.x, vmax.x);
-        vmax.y = fmax(p.y, vmax.y);
-        vmax.z = fmax(p.z, vmax.z);
+// pack_vertices builds the packed vertices from the decoded ones, then
+// frees the decoded ones, as nothing else uses them. Positions and UVs go
+// back to the integers they were decoded from, so only normals lose any
+// precision.
+void pack_vertices(mesh_t* mesh)
+{
+    for (u32 i = 0; i < mesh->num_vertices; i++) {
+        const vertex_t* v = &mesh->vertices[i];
+        packed_vertex_t* p = &mesh->packed_vertices[i];
+
+        bool is_shaded = v->normal.x + v->normal.y + v->normal.z + v->texcoords.x + v->texcoords.y != 0.0f;
+        p->position[0] = (i16)lroundf(v->position.x * 100.0f);
+        p->position[1] = (i16)lroundf(v->position.y * -100.0f);
+        p->position[2] = (i16)lroundf(v->position.z * -100.0f);
+        p->position[3] = is_shaded ? 1 : 0;
+
+        pack_normal(v->normal, p->normal);
+
+        u32 tex_v = (u32)lroundf(v->texcoords.y * 1023.0f);
+        p->uv[0] = (u8)lroundf(v->texcoords.x * 255.0f);
+        p->uv[1] = tex_v & 0xFF;
+        p->uv[2] = tex_v >> 8;
+        p->uv[3] = (u8)v->palette;
     }
 
+    free(mesh->vertices);
+    mesh->vertices = NULL;
+}
+
+// mesh_center_transform centers a map's bounds on x and z.
+static vec3 mesh_center_transform(aabb_t bounds)
+{
     return (vec3) {
-        .x = -(vmax.x + vmin.x) / 2.0,
-        .y = -0.5, // maps already on 0.0. the -0.5 lowers it just a bit.
-        .z = -(vmax.z + vmin.z) / 2.0,
+        .x = -(bounds.max.x + bounds.min.x) / 2.0f,
+        .y = -0.5f, // maps already on 0.0. the -0.5 lowers it just a bit.
+        .z = -(bounds.max.z + bounds.min.z) / 2.0f,
     };
 }
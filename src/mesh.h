@@ -2,20 +2,57 @@
 
 #include <string.h>
 
+#include "arena.h"
 #include "bin.h"
 #include "defines.h"
+#include "jobs.h"
 #include "maths.h"
 
-#define GNS_MAX_SIZE 2388
+#define MAP_MAX_NUM 126
+
+// Bump when loading changes what ends up in a mesh_t, so cached maps
+// decoded by an older version aren't used.
+#define MESH_DECODER_VERSION 10
 #define RECORD_MAX_NUM 100
 
+// Limits on what a map's variants can use. Maps have a handful of each.
+#define MESH_MAX_VARIANTS 16
+#define MESH_MAX_GEOMETRIES 8
+#define MESH_MAX_TEXTURES 8
+
+// A geometry patches at most one range per run of polygons that is
+// decoded on its own, of which a mesh record has at most 16.
+#define MESH_MAX_PATCHES (MESH_MAX_GEOMETRIES * 16)
+
+// Geometries are split into chunks of the triangles in a square of the
+// map, 4x4 tiles of 28 units, so what is out of view can be skipped. Big
+// maps get bigger squares so a geometry has at most MESH_CHUNK_GRID of
+// them on each side.
+#define MESH_CHUNK_SIZE (4 * 28 / 100.0f)
+#define MESH_CHUNK_GRID 16
+#define MESH_MAX_CHUNKS 512
+
+// live_geometry of a mesh whose live indices haven't been filled in.
+#define MESH_NO_GEOMETRY 0xFFFFFFFF
+
 #define MAX_VERTS 5000
 
+// Every corner of the largest mesh record read_map accepts, with quads split
+// into 2 triangles.
+#define MAX_INDICES ((512 * 3) + (768 * 6) + (64 * 3) + (256 * 6))
+
 #define TEXTURE_WIDTH 256
 #define TEXTURE_HEIGHT 1024
-#define TEXTURE_NUM_PIXELS 262144      // 256 * 1024
-#define TEXTURE_NUM_BYTES (262144 * 4) // 256 * 1024 * 4
-#define TEXTURE_RAW_SIZE (TEXTURE_NUM_PIXELS / 2)
+#define TEXTURE_NUM_PIXELS 262144 // 256 * 1024
+
+// Textures are kept packed, 2 pixels per byte.
+#define TEXTURE_PACKED_WIDTH (TEXTURE_WIDTH / 2)
+#define TEXTURE_NUM_BYTES (TEXTURE_NUM_PIXELS / 2)
+
+// Textures are 4 pages of 256x256, stacked vertically.
+#define TEXTURE_PAGE_HEIGHT 256
+#define TEXTURE_NUM_PAGES (TEXTURE_HEIGHT / TEXTURE_PAGE_HEIGHT)
+#define TEXTURE_PAGE_NUM_BYTES (TEXTURE_NUM_BYTES / TEXTURE_NUM_PAGES)
 
 #define PALETTE_NUM_BYTES (16 * 16 * 4)
 
@@ -42,6 +79,14 @@ typedef struct {
     u8 weather;
 } record_t;
 
+// map_state_t is one of the states a map can be shown in. Every GNS
+// record is for one of them.
+typedef struct {
+    u8 arrangement;
+    u8 time;
+    u8 weather;
+} map_state_t;
+
 typedef struct {
     vec3 position;
     vec3 normal;
@@ -49,16 +94,130 @@ typedef struct {
     f32 palette;
 } vertex_t;
 
+// packed_vertex_t is the 16 byte vertex that is uploaded for drawing,
+// built from a vertex_t by pack_vertices. vs_basic in standard.glsl
+// unpacks it.
+typedef struct {
+    // x, y, z as stored on disc. w is 1 for vertices with a normal or UV,
+    // 0 for untextured ones, which are drawn black.
+    i16 position[4];
+    // Octahedral encoded, as snorm16.
+    i16 normal[2];
+    // u, low byte of v, high byte of v, palette. v includes the page.
+    u8 uv[4];
+} packed_vertex_t;
+
+STATIC_ASSERT(sizeof(packed_vertex_t) == 16, "Expected packed_vertex_t to be 16 bytes.");
+
 typedef struct {
     vec3 position;
     vec3 color;
 } light_t;
 
+// geometry_t is one mesh record's polygons, a range of a mesh's vertices
+// and indices. Indices are relative to the first vertex. Its chunks cover
+// all of its indices, in order.
+//
+// A record that only changes some of geometry 0's polygons is kept as
+// patches of it instead. Its vertices and indices are then only those of
+// the polygons it changes, and `num_patches` isn't 0. It has no chunks
+// and is drawn with geometry 0's.
 typedef struct {
-    vertex_t vertices[MAX_VERTS];
+    u32 first_vertex;
     u32 num_vertices;
+    u32 first_index;
+    u32 num_indices;
+    u32 first_patch;
+    u32 num_patches;
+    u32 first_chunk;
+    u32 num_chunks;
+
+    // Bounds of all of the geometry's positions, patched ones included.
+    aabb_t bounds;
+} geometry_t;
+
+// patch_t replaces a range of geometry 0's indices with the ones at
+// `source` in the mesh's indices. Patches keep the size of what they
+// replace, so geometry 0's ranges never move.
+typedef struct {
+    u32 first_index;
+    u32 num_indices;
+    u32 source;
+} patch_t;
 
-    u8 texture[TEXTURE_NUM_BYTES];
+// chunk_t is a range of a geometry's indices, relative to its first index,
+// whose triangles are all in `bounds`. A range of geometry 0 that any
+// geometry patches is a chunk of its own, bounding every patch of it.
+typedef struct {
+    u32 first_index;
+    u32 num_indices;
+    aabb_t bounds;
+} chunk_t;
+
+// variant_t is a map in one state. Geometry and textures are shared by
+// every variant that uses the same record, the rest is small enough to
+// keep for each.
+typedef struct {
+    map_state_t state;
+    u32 geometry;
+    u32 texture;
+    u8 palette[PALETTE_NUM_BYTES];
+    light_t dir_lights[3];
+    vec3 ambient_light_color;
+    vec3 background_top;
+    vec3 background_bottom;
+} variant_t;
+
+typedef struct {
+    // Unique vertices of every geometry, drawn as triangles through
+    // `indices`. These live in `arena`, sized for the map by mesh_alloc.
+    // `vertices` are the decoded ones, which read_map allocates on their
+    // own and pack_vertices frees once it has packed them. Only
+    // `packed_vertices` are drawn or cached.
+    vertex_t* vertices;
+    packed_vertex_t* packed_vertices;
+    u32 num_vertices;
+    u16* indices;
+    u32 num_indices;
+    arena_t arena;
+    geometry_t geometries[MESH_MAX_GEOMETRIES];
+    u32 num_geometries;
+    patch_t patches[MESH_MAX_PATCHES];
+    u32 num_patches;
+    chunk_t chunks[MESH_MAX_CHUNKS];
+    u32 num_chunks;
+
+    // Geometry 0 and its patches are drawn from `live_indices`, geometry
+    // 0's indices with the patches of `live_geometry` applied. Switching
+    // between them only copies the ranges that are patched.
+    u16* live_indices;
+    u32 live_geometry;
+
+    // Every texture the variants use, TEXTURE_NUM_BYTES each of 4-bit
+    // palette indices, allocated by mesh_alloc_textures in
+    // `texture_memory` or set by mesh_use_textures. Each texture that is
+    // read gets a new id, starting at `first_texture_id`.
+    u8* textures;
+    u32 num_textures;
+    u8* texture_memory;
+    u32 max_textures;
+    u64 first_texture_id;
+
+    // The cache file a map was loaded from, kept mapped while its packed
+    // vertices, indices and textures point into it. It is unmapped when
+    // the mesh is reset. See cache_load.
+    u8* mapping;
+    u64 mapping_size;
+
+    variant_t variants[MESH_MAX_VARIANTS];
+    u32 num_variants;
+
+    // The variant that is shown, set by mesh_set_variant. These are
+    // copied from it, or point into the shared data.
+    u32 variant;
+    u32 geometry;
+    u8* texture;
+    u64 texture_id;
     u8 palette[PALETTE_NUM_BYTES];
 
     light_t dir_lights[3];
@@ -66,6 +225,11 @@ typedef struct {
     vec3 background_top;
     vec3 background_bottom;
 
+    // Bounds of the shown geometry, before it is centered, for the camera
+    // and anything that culls or picks.
+    aabb_t bounds;
+    sphere_t bounding_sphere;
+
     // Transform to center all vertices.
     vec3 center_transform;
 
@@ -73,13 +237,22 @@ typedef struct {
     bool is_texture_valid;
 } mesh_t;
 
-bool read_map(int mapnum, mesh_t* out_mesh);
+bool mesh_alloc(mesh_t* mesh, u32 num_vertices, u32 num_indices, u32 num_live_indices);
+bool mesh_alloc_textures(mesh_t* mesh, u32 num_textures);
+void mesh_use_textures(mesh_t* mesh, u8* textures, u32 num_textures);
+void mesh_reset(mesh_t* mesh);
+void mesh_free(mesh_t* mesh);
+void mesh_set_variant(mesh_t* mesh, u32 variant);
+bool mesh_is_live(const mesh_t* mesh, u32 geometry);
+
+const disc_file_t* find_map(disc_t* disc, int mapnum);
+bool read_map(disc_t* disc, int mapnum, jobs_t* jobs, mesh_t* out_mesh);
 bool read_records(file_t* f, record_t* out_records, u16* out_num_records);
-bool read_mesh(file_t* f, mesh_t* out_mesh);
-bool read_texture(file_t* f, mesh_t* out_mesh);
-bool read_palette(file_t* f, mesh_t* out_mesh);
-bool read_lights(file_t* f, mesh_t* out_mesh);
-bool read_background(file_t* f, mesh_t* out_mesh);
+bool read_texture(file_t* f, u8* out_texture);
+bool read_palette(file_t* f, variant_t* out_variant);
+bool read_lights(file_t* f, variant_t* out_variant);
+bool read_background(file_t* f, variant_t* out_variant);
+void pack_vertices(mesh_t* mesh);
 
 f32 read_f1x3x12(file_t* f);
 vec3 read_position(file_t* f);
@@ -0,0 +1,53 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "decode.h"
+#include "resolve.h"
+
+// resolve_page returns a page of the mesh's texture as RGBA8 pixels,
+// coloured with one of its 16 palettes. The pixels stay valid until the
+// next call. It returns NULL if the mesh has no texture or memory runs out.
+const u8* resolve_page(resolve_cache_t* cache, const mesh_t* mesh, u32 page, u32 palette)
+{
+    if (mesh->texture == NULL || page >= TEXTURE_NUM_PAGES || palette >= 16) {
+        return NULL;
+    }
+    const u8* colors = &mesh->palette[palette * sizeof(cache->entries[0].palette)];
+
+    // Palettes are matched by their colours rather than their number, so
+    // a page is still found after the mesh's palettes change.
+    resolved_page_t* entry = &cache->entries[0];
+    for (u32 i = 0; i < RESOLVE_CACHE_SIZE; i++) {
+        resolved_page_t* e = &cache->entries[i];
+        if (e->last_used != 0 && e->texture_id == mesh->texture_id && e->page == page
+            && memcmp(e->palette, colors, sizeof(e->palette)) == 0) {
+            e->last_used = ++cache->clock;
+            return e->pixels;
+        }
+        if (e->last_used < entry->last_used) {
+            entry = e;
+        }
+    }
+
+    // Otherwise the least recently used entry is reused.
+    if (entry->pixels == NULL) {
+        entry->pixels = malloc(RESOLVE_PAGE_NUM_BYTES);
+        if (entry->pixels == NULL) {
+            return NULL;
+        }
+    }
+    decode_texture_rgba(&mesh->texture[page * TEXTURE_PAGE_NUM_BYTES], TEXTURE_PAGE_NUM_BYTES, colors, entry->pixels);
+    entry->texture_id = mesh->texture_id;
+    memcpy(entry->palette, colors, sizeof(entry->palette));
+    entry->page = page;
+    entry->last_used = ++cache->clock;
+    return entry->pixels;
+}
+
+void resolve_cache_free(resolve_cache_t* cache)
+{
+    for (u32 i = 0; i < RESOLVE_CACHE_SIZE; i++) {
+        free(cache->entries[i].pixels);
+    }
+    *cache = (resolve_cache_t) { 0 };
+}
@@ -0,0 +1,29 @@
+// This file contains a cache of texture pages with a palette applied, for
+// code that can't look colours up on the GPU, like exporters or a CPU
+// renderer.
+//
+// Pages are resolved to RGBA8 on first use and kept for each texture,
+// page and palette, so switching between a few palettes is free.
+#pragma once
+
+#include "defines.h"
+#include "mesh.h"
+
+#define RESOLVE_CACHE_SIZE 16
+#define RESOLVE_PAGE_NUM_BYTES (TEXTURE_WIDTH * TEXTURE_PAGE_HEIGHT * 4)
+
+typedef struct {
+    u64 texture_id;
+    u8 palette[PALETTE_NUM_BYTES / 16];
+    u32 page;
+    u64 last_used; // 0 if the entry is empty
+    u8* pixels;
+} resolved_page_t;
+
+typedef struct {
+    resolved_page_t entries[RESOLVE_CACHE_SIZE];
+    u64 clock;
+} resolve_cache_t;
+
+const u8* resolve_page(resolve_cache_t* cache, const mesh_t* mesh, u32 page, u32 palette);
+void resolve_cache_free(resolve_cache_t* cache);
@@ -10,23 +10,36 @@ uniform vs_basic_params {
     mat4 u_projection;
 };
 
-in vec3  a_pos;
-in vec3  a_normal;
-in vec2  a_uv;
-in float a_palette;
+// These are packed, see packed_vertex_t in mesh.h.
+in vec4 a_pos;    // x, y, z in 1/100ths with y and z flipped, w shaded
+in vec2 a_normal; // octahedral
+in vec4 a_uv;     // u, v low byte, v high byte, palette
 
 out vec3  v_pos;
 out vec3  v_normal;
 out vec2  v_uv;
 out float v_palette;
+out float v_shaded;
+
+vec3 unpack_normal(vec2 e)
+{
+    vec3 n = vec3(e.x, e.y, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0) {
+        vec2 signs = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+        n.xy = (1.0 - abs(n.yx)) * signs;
+    }
+    return normalize(n);
+}
 
 void main()
 {
-    v_pos = vec3(u_model * vec4(a_pos, 1.0));
-    v_normal = mat3(transpose(inverse(u_model))) * a_normal;
-    v_uv = a_uv;
-    v_palette = a_palette;
-    gl_Position = u_projection * u_view * u_model * vec4(a_pos, 1.0);
+    vec4 pos = vec4(vec3(a_pos.x, -a_pos.y, -a_pos.z) / 100.0, 1.0);
+    v_pos = vec3(u_model * pos);
+    v_normal = mat3(transpose(inverse(u_model))) * unpack_normal(a_normal);
+    v_uv = vec2(a_uv.x / 255.0, (a_uv.y + (a_uv.z * 256.0)) / 1023.0);
+    v_palette = a_uv.w;
+    v_shaded = a_pos.w;
+    gl_Position = u_projection * u_view * u_model * pos;
 }
 @end
 
@@ -49,6 +62,7 @@ in vec3  v_pos;
 in vec3  v_normal;
 in vec2  v_uv;
 in float v_palette;
+in float v_shaded;
 
 out vec4 frag_color;
 
@@ -68,10 +82,10 @@ void main()
     }
     vec4 light = ambient * 2.0 + diffuse_light_sum;
 
-    // Draw black for triangles without normals (untextured triangles)
-    if (v_normal.x + v_normal.y + v_normal.z + v_uv.x + v_uv.y == 0.0) {
-        // Draw black for things without normals and uv coords.
-        // The uv coords and normal could actually be 0 so we check them both.
+    // Draw black for triangles without normals (untextured triangles).
+    // Whether a vertex has a normal or uv coords is worked out when it is
+    // packed, as a packed normal is never 0.
+    if (v_shaded < 0.5) {
         frag_color = light * vec4(0.1, 0.1, 0.1, 1.0);
         return;
     }
@@ -79,12 +93,14 @@ void main()
     if (u_draw_mode == 0) {
         // Textured
 
-        // This has to be 256.0 instead of 255 (really 255.1 is fine).
-        // And palette_pos needs to be calculated then cast to uint,
-        // not casting each to uint then calculating. Otherwise there
-        // will be distortion in perspective projection on some gpus.
-        vec4 tex_color = texture(u_tex, v_uv) * 256.0;
-        uint palette_pos = uint(v_palette * 16 + tex_color.r);
+        // Each texel holds 2 pixels, the left one in the low nibble.
+        // Which one this is comes from the fractional texel coordinate.
+        // Everything is rounded before casting to uint, as the
+        // interpolated values are slightly off in perspective projection
+        // on some gpus.
+        uint texel = uint(texture(u_tex, v_uv).r * 255.0 + 0.5);
+        uint nibble = fract(v_uv.x * 128.0) < 0.5 ? 0u : 4u;
+        uint palette_pos = uint(v_palette + 0.5) * 16u + ((texel >> nibble) & 15u);
         vec4 color = texture(u_palette, vec2(float(palette_pos) / 255.0, 0.0));
         if (color.a < 0.5)
             discard;
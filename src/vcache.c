@@ -0,0 +1,305 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vcache.h"
+
+// Scoring from Forsyth's paper. The vertices of the last triangle score a
+// bit less than the rest of the cache, so strips don't get stuck, and
+// vertices with few triangles left get a boost so they are finished off.
+#define CACHE_DECAY_POWER 1.5f
+#define LAST_TRIANGLE_SCORE 0.75f
+#define VALENCE_BOOST_SCALE 2.0f
+#define VALENCE_BOOST_POWER 0.5f
+
+typedef struct {
+    i32 cache_position;
+    u32 num_remaining;
+    u32 first_triangle;
+    f32 score;
+} vcache_vertex_t;
+
+static f32 vertex_score(const vcache_vertex_t* vertex)
+{
+    if (vertex->num_remaining == 0) {
+        return -1.0f;
+    }
+
+    f32 score = 0.0f;
+    i32 position = vertex->cache_position;
+    if (position >= 0 && position < 3) {
+        score = LAST_TRIANGLE_SCORE;
+    } else if (position >= 3) {
+        f32 scale = 1.0f / (VCACHE_SIZE - 3);
+        score = powf(1.0f - ((f32)(position - 3) * scale), CACHE_DECAY_POWER);
+    }
+    score += VALENCE_BOOST_SCALE * powf((f32)vertex->num_remaining, -VALENCE_BOOST_POWER);
+    return score;
+}
+
+// reorder_triangles writes the triangles of `indices` to `out` in cache
+// friendly order.
+static bool reorder_triangles(const u16* indices, u32 num_indices, u32 num_vertices, u16* out)
+{
+    u32 num_triangles = num_indices / 3;
+    vcache_vertex_t* vertices = calloc(num_vertices + 1, sizeof(vcache_vertex_t));
+    u32* triangles = malloc((num_indices + 1) * sizeof(u32));
+    f32* triangle_scores = malloc((num_triangles + 1) * sizeof(f32));
+    bool* is_added = calloc(num_triangles + 1, sizeof(bool));
+    if (vertices == NULL || triangles == NULL || triangle_scores == NULL || is_added == NULL) {
+        free(vertices);
+        free(triangles);
+        free(triangle_scores);
+        free(is_added);
+        return false;
+    }
+
+    // Each vertex's triangles are a range of `triangles`. Added triangles
+    // are swapped to the end of the range.
+    for (u32 i = 0; i < num_indices; i++) {
+        vertices[indices[i]].num_remaining++;
+    }
+    u32 offset = 0;
+    for (u32 v = 0; v < num_vertices; v++) {
+        vertices[v].first_triangle = offset;
+        vertices[v].cache_position = -1;
+        offset += vertices[v].num_remaining;
+        vertices[v].num_remaining = 0;
+    }
+    for (u32 i = 0; i < num_indices; i++) {
+        vcache_vertex_t* vertex = &vertices[indices[i]];
+        triangles[vertex->first_triangle + vertex->num_remaining++] = i / 3;
+    }
+
+    for (u32 v = 0; v < num_vertices; v++) {
+        vertices[v].score = vertex_score(&vertices[v]);
+    }
+    for (u32 t = 0; t < num_triangles; t++) {
+        triangle_scores[t] = vertices[indices[(t * 3) + 0]].score
+            + vertices[indices[(t * 3) + 1]].score
+            + vertices[indices[(t * 3) + 2]].score;
+    }
+
+    // The cache holds 3 extra entries so evicted vertices get rescored.
+    u32 cache[VCACHE_SIZE + 3];
+    u32 cache_size = 0;
+    i32 best = -1;
+    for (u32 n = 0; n < num_triangles; n++) {
+        // Without a candidate touching the cache, take the best triangle
+        // left anywhere.
+        if (best == -1) {
+            f32 best_score = -1.0f;
+            for (u32 t = 0; t < num_triangles; t++) {
+                if (!is_added[t] && triangle_scores[t] > best_score) {
+                    best_score = triangle_scores[t];
+                    best = (i32)t;
+                }
+            }
+        }
+
+        const u16* corners = &indices[best * 3];
+        memcpy(&out[n * 3], corners, 3 * sizeof(u16));
+        is_added[best] = true;
+
+        for (u32 c = 0; c < 3; c++) {
+            vcache_vertex_t* vertex = &vertices[corners[c]];
+            u32* list = &triangles[vertex->first_triangle];
+            for (u32 i = 0; i < vertex->num_remaining; i++) {
+                if (list[i] == (u32)best) {
+                    list[i] = list[vertex->num_remaining - 1];
+                    list[vertex->num_remaining - 1] = (u32)best;
+                    vertex->num_remaining--;
+                    break;
+                }
+            }
+        }
+
+        // The triangle's vertices move to the front of the cache.
+        u32 next_cache[VCACHE_SIZE + 3];
+        u32 next_size = 0;
+        for (u32 c = 0; c < 3; c++) {
+            next_cache[next_size++] = corners[c];
+        }
+        for (u32 i = 0; i < cache_size && next_size < VCACHE_SIZE + 3; i++) {
+            if (cache[i] != corners[0] && cache[i] != corners[1] && cache[i] != corners[2]) {
+                next_cache[next_size++] = cache[i];
+            }
+        }
+        for (u32 i = 0; i < next_size; i++) {
+            vcache_vertex_t* vertex = &vertices[next_cache[i]];
+            vertex->cache_position = i < VCACHE_SIZE ? (i32)i : -1;
+            vertex->score = vertex_score(vertex);
+        }
+
+        // Only triangles of cached vertices change score, so the next
+        // triangle is the best of those.
+        best = -1;
+        f32 best_score = -1.0f;
+        for (u32 i = 0; i < next_size; i++) {
+            vcache_vertex_t* vertex = &vertices[next_cache[i]];
+            for (u32 j = 0; j < vertex->num_remaining; j++) {
+                u32 t = triangles[vertex->first_triangle + j];
+                triangle_scores[t] = vertices[indices[(t * 3) + 0]].score
+                    + vertices[indices[(t * 3) + 1]].score
+                    + vertices[indices[(t * 3) + 2]].score;
+                if (triangle_scores[t] > best_score) {
+                    best_score = triangle_scores[t];
+                    best = (i32)t;
+                }
+            }
+        }
+
+        cache_size = next_size < VCACHE_SIZE ? next_size : VCACHE_SIZE;
+        memcpy(cache, next_cache, cache_size * sizeof(u32));
+    }
+
+    free(vertices);
+    free(triangles);
+    free(triangle_scores);
+    free(is_added);
+    return true;
+}
+
+// reorder_vertices renumbers vertices in the order the indices first use
+// them. Any vertex that isn't used goes last, so the count is unchanged.
+static bool reorder_vertices(vertex_t* vertices, u32 num_vertices, u16* indices, u32 num_indices)
+{
+    vertex_t* reordered = malloc((num_vertices + 1) * sizeof(vertex_t));
+    if (reordered == NULL) {
+        return false;
+    }
+
+    u16 remap[MAX_VERTS];
+    memset(remap, 0xFF, sizeof(remap));
+    u16 num_used = 0;
+    for (u32 i = 0; i < num_indices; i++) {
+        u16 index = indices[i];
+        if (remap[index] == 0xFFFF) {
+            reordered[num_used] = vertices[index];
+            remap[index] = num_used++;
+        }
+        indices[i] = remap[index];
+    }
+    for (u32 i = 0; i < num_vertices; i++) {
+        if (remap[i] == 0xFFFF) {
+            reordered[num_used++] = vertices[i];
+        }
+    }
+    memcpy(vertices, reordered, num_vertices * sizeof(vertex_t));
+
+    free(reordered);
+    return true;
+}
+
+// optimize_geometry reorders the triangles between each pair of `cuts` on
+// their own, so triangles never move from one range to another, then
+// renumbers the geometry's vertices.
+static bool optimize_geometry(vertex_t* vertices, u32 num_vertices, u16* indices, const u32* cuts, u32 num_cuts)
+{
+    u32 num_indices = cuts[num_cuts - 1];
+    u16* reordered = malloc((num_indices + 1) * sizeof(u16));
+    if (reordered == NULL) {
+        return false;
+    }
+    bool success = true;
+    for (u32 i = 0; success && i + 1 < num_cuts; i++) {
+        success = reorder_triangles(&indices[cuts[i]], cuts[i + 1] - cuts[i], num_vertices, &reordered[cuts[i]]);
+    }
+    if (success) {
+        memcpy(indices, reordered, num_indices * sizeof(u16));
+        success = reorder_vertices(vertices, num_vertices, indices, num_indices);
+    }
+    free(reordered);
+    return success;
+}
+
+// add_cut adds `cut` to the sorted, unique `cuts`.
+static void add_cut(u32* cuts, u32* num_cuts, u32 cut)
+{
+    u32 i = 0;
+    while (i < *num_cuts && cuts[i] < cut) {
+        i++;
+    }
+    if (i < *num_cuts && cuts[i] == cut) {
+        return;
+    }
+    memmove(&cuts[i + 1], &cuts[i], (*num_cuts - i) * sizeof(u32));
+    cuts[i] = cut;
+    (*num_cuts)++;
+}
+
+// vcache_optimize reorders the triangles and vertices of each of a mesh's
+// geometries for the vertex cache. The mesh draws the same either way.
+//
+// Each chunk, patched ranges of geometry 0, and each patch, are reordered
+// on their own so chunks keep their triangles and patches still line up
+// with what they replace.
+bool vcache_optimize(mesh_t* mesh)
+{
+    bool success = true;
+    for (u32 i = 0; success && i < mesh->num_geometries; i++) {
+        const geometry_t* geometry = &mesh->geometries[i];
+        u32 cuts[(MESH_MAX_PATCHES * 2) + MESH_MAX_CHUNKS + 2];
+        u32 num_cuts = 0;
+        add_cut(cuts, &num_cuts, 0);
+        add_cut(cuts, &num_cuts, geometry->num_indices);
+        for (u32 p = 0; p < mesh->num_patches; p++) {
+            const patch_t* patch = &mesh->patches[p];
+            if (i == 0) {
+                add_cut(cuts, &num_cuts, patch->first_index);
+                add_cut(cuts, &num_cuts, patch->first_index + patch->num_indices);
+            } else if (p >= geometry->first_patch && p < geometry->first_patch + geometry->num_patches) {
+                add_cut(cuts, &num_cuts, patch->source - geometry->first_index);
+            }
+        }
+        for (u32 c = 0; c < geometry->num_chunks; c++) {
+            add_cut(cuts, &num_cuts, mesh->chunks[geometry->first_chunk + c].first_index);
+        }
+
+        vertex_t* vertices = &mesh->vertices[geometry->first_vertex];
+        u16* indices = &mesh->indices[geometry->first_index];
+        success = optimize_geometry(vertices, geometry->num_vertices, indices, cuts, num_cuts);
+    }
+
+    // The live indices were copied from the indices as they were before.
+    mesh->live_geometry = MESH_NO_GEOMETRY;
+    mesh_set_variant(mesh, mesh->variant);
+    return success;
+}
+
+// vcache_acmr returns the average cache miss ratio of `indices`, the
+// vertex shader runs per triangle, with a FIFO cache of `cache_size`.
+// 0.5 is about the best possible, 3.0 means no vertex is ever reused.
+f32 vcache_acmr(const u16* indices, u32 num_indices, u32 cache_size)
+{
+    if (num_indices < 3) {
+        return 0.0f;
+    }
+
+    u32 fifo[64];
+    if (cache_size > 64) {
+        cache_size = 64;
+    }
+    u32 head = 0;
+    u32 size = 0;
+    u32 misses = 0;
+    for (u32 i = 0; i < num_indices; i++) {
+        bool hit = false;
+        for (u32 j = 0; j < size; j++) {
+            if (fifo[j] == indices[i]) {
+                hit = true;
+                break;
+            }
+        }
+        if (hit) {
+            continue;
+        }
+        misses++;
+        fifo[head] = indices[i];
+        head = (head + 1) % cache_size;
+        if (size < cache_size) {
+            size++;
+        }
+    }
+    return (f32)misses / (f32)(num_indices / 3);
+}
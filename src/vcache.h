@@ -0,0 +1,16 @@
+// This file contains the post-transform vertex cache optimisation of map
+// meshes.
+//
+// Triangles are reordered with Tom Forsyth's linear-speed vertex cache
+// optimisation, then vertices are renumbered in the order they are first
+// used so vertex fetches are close together too.
+#pragma once
+
+#include "defines.h"
+#include "mesh.h"
+
+// Size of the LRU cache the optimiser models.
+#define VCACHE_SIZE 32
+
+bool vcache_optimize(mesh_t* mesh);
+f32 vcache_acmr(const u16* indices, u32 num_indices, u32 cache_size);